@@ -0,0 +1,177 @@
+// compares the ways loadObj can find the cells a face touches: testing
+// its whole bounding box with triBoxOverlap() per cell or VoxelTriBox
+// batches, and rasterizing it with VoxelTriCells. it only needs the two
+// headers:
+//
+//     c++ -std=c++11 -O2 -I../src tribox.cpp -o tribox && ./tribox
+//
+// prints ns per bounding box cell, how many cells each way tested per hit
+// and checks the hits agree, for faces of a few sizes (in cells) and for
+// long thin diagonal ones.
+
+#include "VoxelTriBox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+struct Face
+{
+	float tri[3][3];
+	int lo[3], hi[3];
+};
+
+static float rnd(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static vector<Face> makeFaces(int count, float size, bool thin, const float origin[3], float step)
+{
+	vector<Face> faces(count);
+
+	for (int i = 0; i < count; i++)
+	{
+		Face& f = faces[i];
+		float base[3] = { rnd(0, 100), rnd(0, 100), rnd(0, 100) };
+
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 3; c++)
+				f.tri[k][c] = origin[c] + (base[c] + rnd(0, size)) * step;
+
+		// corner to corner of the box, the third vertex a cell off the second
+		if (thin)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				f.tri[0][c] = origin[c] + base[c] * step;
+				f.tri[1][c] = origin[c] + (base[c] + size) * step;
+				f.tri[2][c] = f.tri[1][c] + rnd(-1, 1) * step;
+			}
+		}
+
+		// the same cells voxelizeFace() walks
+		for (int c = 0; c < 3; c++)
+		{
+			float mn = min(f.tri[0][c], min(f.tri[1][c], f.tri[2][c]));
+			float mx = max(f.tri[0][c], max(f.tri[1][c], f.tri[2][c]));
+			f.lo[c] = floor((mn - origin[c]) / step);
+			f.hi[c] = ceil((mx - origin[c]) / step);
+		}
+	}
+
+	return faces;
+}
+
+static double seconds()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// f(face) returns the hit count, summed so nothing is optimized out
+template <typename F>
+static double run(const vector<Face>& faces, long cells, long& hits, F f)
+{
+	double best = 1e30;
+	for (int rep = 0; rep < 3; rep++)
+	{
+		hits = 0;
+		double t = seconds();
+		for (size_t i = 0; i < faces.size(); i++) hits += f(faces[i]);
+		best = min(best, seconds() - t);
+	}
+	return best / cells * 1e9;
+}
+
+int main()
+{
+	const float origin[3] = { -12.5f, 3.25f, 40 };
+	const float step = 0.173f;
+	const float half = step / 2;
+
+	struct Shape
+	{
+		float size;
+		bool thin;
+	};
+	const Shape shapes[] = { { 1, false }, { 4, false }, { 16, false }, { 64, false }, { 16, true }, { 64, true } };
+
+	printf("%-10s %-8s %12s %12s %12s %12s %12s %10s\n", "size", "faces", "scalar", "batch", "raster",
+		   "bbox/hit", "raster/hit", "fallbacks");
+
+	for (int s = 0; s < 6; s++)
+	{
+		float size = shapes[s].size;
+		int count = 2000000 / (size * size * size + 8);
+		vector<Face> faces = makeFaces(count, size, shapes[s].thin, origin, step);
+
+		long cells = 0;
+		for (size_t i = 0; i < faces.size(); i++)
+			cells += (long)(faces[i].hi[0] - faces[i].lo[0]) * (faces[i].hi[1] - faces[i].lo[1]) * (faces[i].hi[2] - faces[i].lo[2]);
+
+		long scalar_hits, batch_hits, raster_hits;
+		size_t tested = 0, fallbacks = 0;
+
+		double scalar = run(faces, cells, scalar_hits, [&](const Face& f)
+		{
+			int hits = 0;
+			for (int x = f.lo[0]; x < f.hi[0]; x++)
+				for (int y = f.lo[1]; y < f.hi[1]; y++)
+					for (int z = f.lo[2]; z < f.hi[2]; z++)
+					{
+						float cx = (origin[0] + x * step) + half;
+						float cy = (origin[1] + y * step) + half;
+						float cz = (origin[2] + z * step) + half;
+						hits += VoxelTriBox::overlapScalar(f.tri, &cx, &cy, &cz, half, 0, 1);
+					}
+			return hits;
+		});
+
+		double batch = run(faces, cells, batch_hits, [&](const Face& f)
+		{
+			float cx[VoxelTriBox::MAX_BOXES], cy[VoxelTriBox::MAX_BOXES], cz[VoxelTriBox::MAX_BOXES];
+			int hits = 0, n = 0;
+			for (int x = f.lo[0]; x < f.hi[0]; x++)
+				for (int y = f.lo[1]; y < f.hi[1]; y++)
+					for (int z = f.lo[2]; z < f.hi[2]; z++)
+					{
+						cx[n] = (origin[0] + x * step) + half;
+						cy[n] = (origin[1] + y * step) + half;
+						cz[n] = (origin[2] + z * step) + half;
+						if (++n == VoxelTriBox::MAX_BOXES)
+						{
+							hits += __builtin_popcount(VoxelTriBox::overlap(f.tri, cx, cy, cz, half, n));
+							n = 0;
+						}
+					}
+			if (n) hits += __builtin_popcount(VoxelTriBox::overlap(f.tri, cx, cy, cz, half, n));
+			return hits;
+		});
+
+		double raster = run(faces, cells, raster_hits, [&](const Face& f)
+		{
+			VoxelTriCells t(f.tri, origin, step);
+			int hits = 0;
+			t.forEachCell(f.lo, f.hi, [&](int, int, int) { hits++; });
+			tested += t.getNumTested();
+			fallbacks += t.getNumFallbacks();
+			return hits;
+		});
+
+		double per_hit = max(scalar_hits, 1L);
+		printf("%-4g %-5s %-8d %9.2f ns %9.2f ns %9.2f ns %12.2f %12.2f %10zu\n", size, shapes[s].thin ? "thin" : "", count,
+			   scalar, batch, raster, cells / per_hit, tested / 3 / per_hit, fallbacks / 3);
+
+		if (batch_hits != scalar_hits || raster_hits != scalar_hits)
+		{
+			printf("hit counts differ: %ld %ld %ld\n", scalar_hits, batch_hits, raster_hits);
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,308 @@
+// checks that the faster ways of finding the cells a face touches give the
+// same answers as triBoxOverlap(): VoxelTriBox::overlap() masks against
+// overlapScalar() in every mode the cpu has, and VoxelTriCells cells
+// against testing each cell around the face. like tribox.cpp it only needs
+// the two headers:
+//
+//     c++ -std=c++11 -O2 -I../src triboxcheck.cpp -o triboxcheck && ./triboxcheck
+//
+// besides random faces it tries the ones near the edge cases: degenerate
+// faces (a point, a segment, two vertices the same), faces in a plane of
+// the axes or with edges along them, and faces lying on grid planes and
+// grid lines, on a grid with an odd step and one with exact float cells.
+// prints a line per kind of face and exits with 1 on any difference.
+
+#include "VoxelTriBox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+struct Grid
+{
+	const char* name;
+	float origin[3];
+	float step;
+};
+
+struct Face
+{
+	float tri[3][3];
+};
+
+static float rnd(float lo, float hi)
+{
+	return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static int rndInt(int lo, int hi)
+{
+	return lo + rand() % (hi - lo + 1);
+}
+
+// a point on the grid, in cells, with the same float math as the cell centres
+static void gridPoint(const Grid& g, const float cells[3], float p[3])
+{
+	for (int c = 0; c < 3; c++) p[c] = g.origin[c] + cells[c] * g.step;
+}
+
+// the kinds of faces, each made in cell units and moved onto the grid
+enum Kind
+{
+	RANDOM,
+	THIN,
+	POINT,
+	SEGMENT,
+	TWO_SAME,
+	AXIS_PLANE,
+	AXIS_EDGES,
+	GRID_PLANE,
+	GRID_LINES,
+	NUM_KINDS
+};
+
+static const char* kind_names[NUM_KINDS] = {
+	"random", "thin", "point", "segment", "two same", "axis plane", "axis edges", "grid plane", "grid lines"
+};
+
+static Face makeFace(const Grid& g, Kind kind)
+{
+	float p[3][3];
+	float base[3] = { rnd(0, 20), rnd(0, 20), rnd(0, 20) };
+	float size = rnd(0.2f, 12);
+
+	for (int k = 0; k < 3; k++)
+		for (int c = 0; c < 3; c++)
+			p[k][c] = base[c] + rnd(0, size);
+
+	int a = rndInt(0, 2);
+
+	switch (kind)
+	{
+	case RANDOM:
+		break;
+
+	case THIN:
+		for (int c = 0; c < 3; c++)
+		{
+			p[1][c] = p[0][c] + size;
+			p[2][c] = p[1][c] + rnd(-0.01f, 0.01f);
+		}
+		break;
+
+	case POINT:
+		for (int c = 0; c < 3; c++) p[1][c] = p[2][c] = p[0][c];
+		break;
+
+	case SEGMENT:
+	{
+		float s = rnd(0, 1);
+		for (int c = 0; c < 3; c++) p[2][c] = p[0][c] + (p[1][c] - p[0][c]) * s;
+		break;
+	}
+
+	case TWO_SAME:
+		for (int c = 0; c < 3; c++) p[2][c] = p[1][c];
+		break;
+
+	// all three vertices share one coordinate
+	case AXIS_PLANE:
+		p[1][a] = p[2][a] = p[0][a];
+		break;
+
+	// a right triangle with its legs along two axes
+	case AXIS_EDGES:
+	{
+		int b = (a + 1) % 3;
+		for (int c = 0; c < 3; c++) p[1][c] = p[2][c] = p[0][c];
+		p[1][a] += rnd(-size, size);
+		p[2][b] += rnd(-size, size);
+		break;
+	}
+
+	// in a plane between two layers of cells, vertices anywhere in it
+	case GRID_PLANE:
+		p[0][a] = p[1][a] = p[2][a] = floorf(base[a]);
+		break;
+
+	// every vertex on a cell corner, so edges along axes lie on grid lines
+	// and the rest cross corners
+	case GRID_LINES:
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 3; c++)
+				p[k][c] = floorf(p[k][c]);
+		if (rand() % 2) p[1][a] = p[2][a] = p[0][a];
+		break;
+
+	default:
+		break;
+	}
+
+	Face f;
+	for (int k = 0; k < 3; k++) gridPoint(g, p[k], f.tri[k]);
+	return f;
+}
+
+// the cells around the face, a cell wider on each side than the ones
+// voxelizeFace() walks so the neighbours get checked too
+static void bounds(const Grid& g, const Face& f, int lo[3], int hi[3])
+{
+	for (int c = 0; c < 3; c++)
+	{
+		float mn = min(f.tri[0][c], min(f.tri[1][c], f.tri[2][c]));
+		float mx = max(f.tri[0][c], max(f.tri[1][c], f.tri[2][c]));
+		lo[c] = (int)floor((mn - g.origin[c]) / g.step) - 1;
+		hi[c] = (int)ceil((mx - g.origin[c]) / g.step) + 1;
+	}
+}
+
+struct Cell
+{
+	int x, y, z;
+
+	bool operator<(const Cell& o) const
+	{
+		if (x != o.x) return x < o.x;
+		if (y != o.y) return y < o.y;
+		return z < o.z;
+	}
+
+	bool operator==(const Cell& o) const { return x == o.x && y == o.y && z == o.z; }
+};
+
+struct Result
+{
+	long faces, cells, hits;
+	long mask_errors, raster_errors;
+};
+
+// the bounding box cells in batches of 1 to MAX_BOXES, so every tail
+// length goes through the lanes, against one triBoxOverlap() per cell
+static void checkMasks(const Grid& g, const Face& f, const int lo[3], const int hi[3], Result& r, vector<Cell>& hits)
+{
+	float half = g.step / 2;
+	float cx[VoxelTriBox::MAX_BOXES], cy[VoxelTriBox::MAX_BOXES], cz[VoxelTriBox::MAX_BOXES];
+	Cell cells[VoxelTriBox::MAX_BOXES];
+	int n = 0;
+	int batch = rndInt(1, VoxelTriBox::MAX_BOXES);
+
+	const VoxelTriBox::Mode modes[] = { VoxelTriBox::SCALAR, VoxelTriBox::LANES_4, VoxelTriBox::LANES_8, VoxelTriBox::LANES_16 };
+
+	auto flush = [&]()
+	{
+		uint32_t expected = VoxelTriBox::overlapScalar(f.tri, cx, cy, cz, half, 0, n);
+
+		for (int m = 0; m < 4; m++)
+		{
+			VoxelTriBox::setMode(modes[m]);
+			uint32_t mask = VoxelTriBox::overlap(f.tri, cx, cy, cz, half, n);
+			if (mask != expected)
+			{
+				if (r.mask_errors++ < 5)
+					printf("mode %d, %d boxes: mask %08x, scalar %08x\n", (int)VoxelTriBox::getMode(), n, mask, expected);
+			}
+		}
+
+		for (int i = 0; i < n; i++)
+			if ((expected >> i) & 1) hits.push_back(cells[i]);
+
+		n = 0;
+		batch = rndInt(1, VoxelTriBox::MAX_BOXES);
+	};
+
+	for (int x = lo[0]; x < hi[0]; x++)
+		for (int y = lo[1]; y < hi[1]; y++)
+			for (int z = lo[2]; z < hi[2]; z++)
+			{
+				cx[n] = (g.origin[0] + x * g.step) + half;
+				cy[n] = (g.origin[1] + y * g.step) + half;
+				cz[n] = (g.origin[2] + z * g.step) + half;
+				Cell c = { x, y, z };
+				cells[n] = c;
+				if (++n == batch) flush();
+				r.cells++;
+			}
+	if (n) flush();
+}
+
+static void checkRaster(const Grid& g, const Face& f, const int lo[3], const int hi[3], Result& r, vector<Cell>& expected)
+{
+	vector<Cell> cells;
+	VoxelTriCells t(f.tri, g.origin, g.step);
+	t.forEachCell(lo, hi, [&](int x, int y, int z)
+	{
+		Cell c = { x, y, z };
+		cells.push_back(c);
+	});
+
+	sort(cells.begin(), cells.end());
+	sort(expected.begin(), expected.end());
+
+	// a cell twice is as wrong as a missing one
+	if (cells != expected)
+	{
+		if (r.raster_errors++ < 5)
+		{
+			printf("raster %zu cells, brute force %zu, face", cells.size(), expected.size());
+			for (int k = 0; k < 3; k++) printf(" (%.9g %.9g %.9g)", f.tri[k][0], f.tri[k][1], f.tri[k][2]);
+			printf("\n");
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+
+	const Grid grids[] = {
+		{ "odd", { -12.5f, 3.25f, 40 }, 0.173f },
+		{ "exact", { 0, -8, 16 }, 0.25f }
+	};
+	const int faces_per_kind = 4000;
+
+	VoxelTriBox::Mode best = VoxelTriBox::getMode();
+	printf("lanes up to mode %d\n", (int)best);
+
+	printf("%-6s %-12s %8s %10s %10s %8s %8s\n", "grid", "faces", "count", "cells", "hits", "masks", "raster");
+
+	bool failed = false;
+
+	for (int gi = 0; gi < 2; gi++)
+	{
+		const Grid& g = grids[gi];
+
+		for (int kind = 0; kind < NUM_KINDS; kind++)
+		{
+			Result r = { 0, 0, 0, 0, 0 };
+			vector<Cell> hits;
+
+			for (int i = 0; i < faces_per_kind; i++)
+			{
+				Face f = makeFace(g, (Kind)kind);
+
+				int lo[3], hi[3];
+				bounds(g, f, lo, hi);
+
+				hits.clear();
+				checkMasks(g, f, lo, hi, r, hits);
+				r.hits += hits.size();
+				checkRaster(g, f, lo, hi, r, hits);
+				r.faces++;
+			}
+
+			printf("%-6s %-12s %8ld %10ld %10ld %8ld %8ld\n", g.name, kind_names[kind], r.faces, r.cells, r.hits,
+				   r.mask_errors, r.raster_errors);
+
+			if (r.mask_errors || r.raster_errors) failed = true;
+		}
+	}
+
+	VoxelTriBox::setMode(best);
+
+	if (failed) printf("answers differ\n");
+	return failed ? 1 : 0;
+}
@@ -4,10 +4,6 @@ const int NUM_CELL = 80;
 const unsigned int CELL_SIZE = 5;
 const float EDITOR_SIZE_IN_CM = 200;
 
-const unsigned int VOXEL_TAG = 100;
-const unsigned int FLOOR_TAG = 101;
-
-const unsigned int HANDLE_TAG = 200;
 const unsigned int HANDLE_X_TAG = 201;
 const unsigned int HANDLE_Y_TAG = 202;
 const unsigned int HANDLE_Z_TAG = 203;
@@ -15,6 +11,8 @@ const unsigned int HANDLE_NEG_X_TAG = 204;
 const unsigned int HANDLE_NEG_Y_TAG = 205;
 const unsigned int HANDLE_NEG_Z_TAG = 206;
 
+const float HANDLE_SIZE = 0.2;
+
 inline ofMatrix4x4 getGridToWorldMatrix() {
 	ofMatrix4x4 gridToWorldMatrix;
 	
@@ -4,6 +4,11 @@
 
 #include "Constance.h"
 #include "VoxelData.h"
+#include "VoxelHistory.h"
+#include "VoxelPicker.h"
+#include "VoxelProfiler.h"
+#include "VoxelRenderer.h"
+#include "VoxelTask.h"
 
 class Editor
 {
@@ -17,6 +22,14 @@ public:
 		EDITMODE_PICK_COLOR
 	} editmode;
 	
+	enum RenderMode
+	{
+		RENDERMODE_MESH,
+		RENDERMODE_INSTANCED,
+		RENDERMODE_BOXES,
+		NUM_RENDERMODES
+	} rendermode;
+	
 	void setup()
 	{
 		gridToWorldMatrix = getGridToWorldMatrix();
@@ -31,6 +44,7 @@ public:
 		voxel_color.set(255);
 		selected_voxel = NULL;
 		focused_voxel = NULL;
+		half_selected_voxel = NULL;
 		
 		cam.setFov(60);
 
@@ -38,15 +52,39 @@ public:
 		setupUI();
 		
 		editmode = EDITMODE_PUT;
+		rendermode = RENDERMODE_MESH;
 		put_failed = false;
+		lod = true;
 		
 		json_filename = "default.json";
+		json_version = 1;
+		
+		// pick up where the last session ended, crashed or not
+		journal.open("autosave");
+		if (journal.recover(voxels)) journal.compact(voxels);
+		else journal.reset(voxels);
+		history.setJournal(&journal);
 	}
 
 	void update()
 	{
+		VoxelProfiler::get().frame();
+		VoxelProfiler::get().gauge("undo bytes", history.getMemoryUsage());
+		VOXEL_PROFILE("update");
+
+		updateTask();
+		journal.update(voxels);
+
 		cursor_t += (cursor - cursor_t) * 0.5;
 		updateCamera();
+		
+		if (rendermode == RENDERMODE_MESH)
+		{
+			mesh_renderer.setLevel(lod ? getLodLevel() : 0);
+			mesh_renderer.update(voxels);
+		}
+		else if (rendermode == RENDERMODE_INSTANCED)
+			instance_renderer.update(voxels);
 	}
 
 	void draw()
@@ -118,19 +156,25 @@ public:
 
 		ofDisableLighting();
 		glPopAttrib();
+		
+		drawRenderStats();
+		drawTaskProgress();
+		VoxelProfiler::get().draw(ofGetWidth() / 2 - 180, 18);
 	}
 
 public:
+	// zoom and pan go faster the further out the camera is, so large
+	// models are as quick to get around as small ones
 	void moveCamera(float x, float y, float z = 0)
 	{
-		orbit_t += ofVec3f(x, y, z);
+		orbit_t += ofVec3f(x, y, z * orbit_t.z / 150);
 		orbit_t.y = ofClamp(orbit_t.y, -90, 90);
-		orbit_t.z = ofClamp(orbit_t.z, 50, 600);
+		orbit_t.z = ofClamp(orbit_t.z, 50, 20000);
 	}
 
 	void offsetCamera(float x, float y)
 	{
-		offset_t += cam.getOrientationQuat() * ofVec3f(x, y);
+		offset_t += cam.getOrientationQuat() * ofVec3f(x, y) * (orbit_t.z / 150);
 	}
 
 	void moveCursor(float x, float y, float z = 0)
@@ -158,66 +202,69 @@ public:
 
 		cursor += m;
 
-		if (cursor.x <= 0) cursor.x = 0;
-		if (cursor.x >= 80) cursor.x = 80 - 1;
-
-		if (cursor.y <= 0) cursor.y = 0;
-		if (cursor.y >= 2000) cursor.y = 2000 - 1;
-
-		if (cursor.z <= 0) cursor.z = 0;
-		if (cursor.z >= 60) cursor.z = 60 - 1;
+		// the cursor may leave the floor, only keep within what the index can address
+		cursor.x = ofClamp(cursor.x, VoxelIndex::MIN_COORD, VoxelIndex::MAX_COORD);
+		cursor.y = ofClamp(cursor.y, VoxelIndex::MIN_COORD, VoxelIndex::MAX_COORD);
+		cursor.z = ofClamp(cursor.z, VoxelIndex::MIN_COORD, VoxelIndex::MAX_COORD);
 	}
 
 	void onMoved(int x, int y)
 	{
-		focused_voxel = voxel_hittest(x, y);
+		focused_voxel = voxel_hittest(x, y, focused);
 	}
 
 	void onPressed(int x, int y)
 	{
-		half_selected_voxel = voxel_hittest(x, y);
+		half_selected_voxel = voxel_hittest(x, y, half_selected);
 		
 		if (editmode == EDITMODE_RESIZE
 			|| editmode == EDITMODE_MOVE)
 		{
 			unsigned int handle = handle_hittest(x, y);
+			VoxelData target;
 			
-			if (handle != 0 && selected_voxel != NULL)
+			if (handle != 0 && editSelected(target))
 			{
 				int amt = 1;
 				if (ofGetModifierPressed(OF_KEY_SHIFT)) amt *= -1;
 				
-				pushUndoBuffer();
+				VoxelData v = target;
 				
 				if (editmode == EDITMODE_RESIZE)
 				{
+					// never shrink below one cell
+					int size = v.w;
+					if (handle == HANDLE_Y_TAG || handle == HANDLE_NEG_Y_TAG) size = v.h;
+					if (handle == HANDLE_Z_TAG || handle == HANDLE_NEG_Z_TAG) size = v.d;
+					if (size + amt < 1) return;
+					
 					switch (handle)
 					{
 						case HANDLE_X_TAG:
-							selected_voxel->w += amt;
+							v.w += amt;
 							cursor.x += amt;
 							break;
 						case HANDLE_Y_TAG:
-							selected_voxel->h += amt;
+							v.h += amt;
 							cursor.y += amt;
 							break;
 						case HANDLE_Z_TAG:
-							selected_voxel->d += amt;
+							v.d += amt;
 							cursor.z += amt;
 							break;
 						case HANDLE_NEG_X_TAG:
-							selected_voxel->w += amt;
-							selected_voxel->x -= amt;
+							v.w += amt;
+							v.x -= amt;
 							cursor.x -= amt;
 							break;
 						case HANDLE_NEG_Y_TAG:
-							selected_voxel->h += amt;
-							selected_voxel->y -= amt;
+							v.h += amt;
+							v.y -= amt;
 							cursor.y -= amt;
 							break;
 						case HANDLE_NEG_Z_TAG:
-							selected_voxel->d += amt;
-							selected_voxel->z -= amt;
+							v.d += amt;
+							v.z -= amt;
 							cursor.z -= amt;
 							break;
 					}
@@ -226,31 +273,39 @@ public:
 					switch (handle)
 					{
 						case HANDLE_X_TAG:
-							selected_voxel->x += amt;
+							v.x += amt;
 							cursor.x += amt;
 							break;
 						case HANDLE_Y_TAG:
-							selected_voxel->y += amt;
+							v.y += amt;
 							cursor.y += amt;
 							break;
 						case HANDLE_Z_TAG:
-							selected_voxel->z += amt;
+							v.z += amt;
 							cursor.z += amt;
 							break;
 						case HANDLE_NEG_X_TAG:
-							selected_voxel->x -= amt;
+							v.x -= amt;
 							cursor.x -= amt;
 							break;
 						case HANDLE_NEG_Y_TAG:
-							selected_voxel->y -= amt;
+							v.y -= amt;
 							cursor.y -= amt;
 							break;
 						case HANDLE_NEG_Z_TAG:
-							selected_voxel->z -= amt;
+							v.z -= amt;
 							cursor.z -= amt;
 							break;
 					}
 				}
+				
+				VoxelData stored;
+				if (voxels.update(target, v, &stored))
+				{
+					history.update(target, stored);
+					history.commit();
+					selected = stored;
+				}
 			}
 		}
 		
@@ -278,11 +333,13 @@ public:
 	
 	void onReleased(int x, int y)
 	{
-		VoxelData* o = voxel_hittest(x, y);
-		if (o != NULL
-			&& half_selected_voxel == o)
+		VoxelData o;
+		if (voxel_hittest(x, y, o) != NULL
+			&& half_selected_voxel != NULL
+			&& isSameVoxel(*half_selected_voxel, o))
 		{
-			selected_voxel = o;
+			selected = o;
+			selected_voxel = &selected;
 		}
 		
 		half_selected_voxel = NULL;
@@ -297,28 +354,32 @@ public:
 	
 	void put()
 	{
-		if (editmode != EDITMODE_PUT) return;
+		if (editmode != EDITMODE_PUT || isReadOnly()) return;
 		
 		{
-			// check voxels
-			const vector<VoxelData>& arr = voxels.getVoxels();
-			for (int i = 0; i < arr.size(); i++)
+			// can replace only W/H/D == 1 voxel, the cell may be inside more
+			// than one box
+			VoxelRegion r;
+			r.x0 = cursor.x;
+			r.y0 = cursor.y;
+			r.z0 = cursor.z;
+			r.x1 = r.x0 + 1;
+			r.y1 = r.y0 + 1;
+			r.z1 = r.z0 + 1;
+			
+			vector<VoxelData> covering;
+			voxels.query(r, covering);
+			for (int i = 0; i < covering.size(); i++)
 			{
-				const VoxelData& v = arr[i];
-				if (v.isInside(cursor.x, cursor.y, cursor.z))
+				const VoxelData& v = covering[i];
+				if (v.w > 1 || v.h > 1 || v.d > 1)
 				{
-					// can replace only W/H/D == 1 voxel
-					if (v.w > 1 || v.h > 1 || v.d > 1)
-					{
-						put_failed = true;
-						return false;
-					}
+					put_failed = true;
+					return;
 				}
 			}
 		}
 		
-		pushUndoBuffer();
-		
 		VoxelData v;
 		
 		v.x = cursor.x;
@@ -331,27 +392,70 @@ public:
 		
 		v.color = voxel_color;
 		
-		voxels.add(v);
+		VoxelData replaced, added;
+		bool replacing = voxels.at(v.x, v.y, v.z, replaced);
+		
+		if (!voxels.add(v, &added)) return;
 		
-		selected_voxel = &voxels.getVoxels().back();
-		focused_voxel = &voxels.getVoxels().back();
+		if (replacing) history.remove(replaced);
+		history.add(added);
+		history.commit();
+		
+		selected = focused = added;
+		selected_voxel = &selected;
+		focused_voxel = &focused;
 	}
 	
 	void remove()
 	{
-		if (selected_voxel != NULL)
+		if (isReadOnly()) return;
+		
+		VoxelData target;
+		if (editSelected(target))
 		{
-			pushUndoBuffer();
-			voxels.remove(*selected_voxel);
+			history.remove(target);
+			history.commit();
+			voxels.remove(target);
 			selected_voxel = NULL;
+			focused_voxel = NULL;
 		}
-		else if (voxels.exists(cursor))
+		else if (voxels.at(cursor.x, cursor.y, cursor.z, target))
 		{
-			pushUndoBuffer();
+			history.remove(target);
+			history.commit();
 			voxels.remove(cursor);
+			focused_voxel = NULL;
 		}
 	}
 
+	void setRenderMode(RenderMode m)
+	{
+		rendermode = m;
+	}
+	
+	void toggleRenderMode()
+	{
+		setRenderMode((RenderMode)((rendermode + 1) % NUM_RENDERMODES));
+	}
+	
+	void toggleLod()
+	{
+		lod = !lod;
+	}
+	
+	void toggleProfiler()
+	{
+		VoxelProfiler::get().toggle();
+	}
+	
+	// the recent frames as chrome trace-event json, next to the data folder files
+	void saveTrace()
+	{
+		string path = "trace-" + ofGetTimestampString() + ".json";
+		if (VoxelProfiler::get().saveTrace(path))
+			ofLogNotice("Editor") << "trace saved to " << path;
+	}
+	
 	void setEditMode(EditMode m)
 	{
 		for (int i = 0; i < tool_group.size(); i++)
@@ -375,6 +479,9 @@ private:
 	ofColor voxel_color;
 	ofVec3f cursor, cursor_t;
 
+	// copies of the voxels under the mouse, the pointers are NULL or point
+	// at them. see editSelected()
+	VoxelData half_selected, selected, focused;
 	VoxelData* half_selected_voxel;
 	VoxelData* selected_voxel;
 	VoxelData* focused_voxel;
@@ -383,6 +490,7 @@ private:
 	ofVec3f offset, offset_t;
 	
 	bool put_failed;
+	bool lod;
 
 private:
 	void updateCamera()
@@ -400,32 +508,72 @@ private:
 		m.preMultTranslate(offset);
 
 		cam.setTransformMatrix(m);
+		cam.setNearClip(orbit.z / 100);
+		cam.setFarClip(orbit.z * 100);
+	}
+
+	// coarser levels once a cell gets smaller than two pixels at the orbit
+	// centre, up to one cell per chunk
+	int getLodLevel()
+	{
+		float cell = EDITOR_SIZE_IN_CM / (NUM_CELL - 1);
+		float pixels = cell / (2 * orbit.z * tan(ofDegToRad(cam.getFov() / 2))) * ofGetHeight();
+		
+		int level = 0;
+		while (level < VoxelChunk::SHIFT && pixels * (1 << level) < 2) level++;
+		return level;
 	}
 
 	void drawFloor()
 	{
-		const float n = NUM_CELL;
+		VOXEL_PROFILE("drawFloor");
+
+		// the default 80x60x60 area, grown to the model and the cursor
+		int lo[3] = { 0, 0, 0 };
+		int hi[3] = { NUM_CELL, 60, 60 };
+
+		VoxelRegion r;
+		if (voxels.getBounds(r))
+		{
+			lo[0] = min(lo[0], r.x0);
+			lo[1] = min(lo[1], r.y0);
+			lo[2] = min(lo[2], r.z0);
+			hi[0] = max(hi[0], r.x1);
+			hi[1] = max(hi[1], r.y1);
+			hi[2] = max(hi[2], r.z1);
+		}
+
+		int c[3] = { (int)floor(cursor.x), (int)floor(cursor.y), (int)floor(cursor.z) };
+		for (int a = 0; a < 3; a++)
+		{
+			lo[a] = min(lo[a], c[a]);
+			hi[a] = max(hi[a], c[a] + 1);
+		}
+
+		// a checker of at most 80x80 tiles, each a power of two cells wide
+		int tile = 1;
+		while ((hi[0] - lo[0]) / tile > NUM_CELL || (hi[2] - lo[2]) / tile > NUM_CELL) tile *= 2;
+
+		int x0 = (int)floor(lo[0] / (float)tile), x1 = (int)ceil(hi[0] / (float)tile);
+		int z0 = (int)floor(lo[2] / (float)tile), z1 = (int)ceil(hi[2] / (float)tile);
 
 		glPushMatrix();
-		glTranslatef(-0.5, -0.5, -0.5);
+		glTranslatef(-0.5, lo[1] - 0.5, -0.5);
 
 		ofFill();
 
 		glPushMatrix();
 		glRotatef(90, 1, 0, 0);
 
-		bool c = false;
-		for (int x = 0; x < 80; x++)
+		for (int x = x0; x < x1; x++)
 		{
-			c = (x % 2) == 0;
-			for (int y = 0; y < 60; y++)
+			for (int z = z0; z < z1; z++)
 			{
-				if (c)
+				if ((x + z) % 2 == 0)
 					ofSetColor(90);
 				else
 					ofSetColor(80);
-				c = !c;
-				ofRect(x, y, 1, 1);
+				ofRect(x * tile, z * tile, tile, tile);
 			}
 		}
 
@@ -433,7 +581,8 @@ private:
 
 		ofNoFill();
 		ofPushMatrix();
-		ofScale(80, 60, 60);
+		ofTranslate(lo[0], 0, lo[2]);
+		ofScale(hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]);
 		ofDrawBox(0.5, 0.5, 0.5, 1);
 		ofPopMatrix();
 
@@ -442,23 +591,32 @@ private:
 
 	void drawVoxel()
 	{
+		VOXEL_PROFILE("drawVoxel");
+		VoxelProfiler::get().count("voxels drawn", voxels.size());
+
 		glPushAttrib(GL_ALL_ATTRIB_BITS);
 		glPushMatrix();
 		ofNoFill();
 
+		if (rendermode == RENDERMODE_MESH)
+		{
+			glEnable(GL_DEPTH_TEST);
+			mesh_renderer.draw();
+		}
+		else if (rendermode == RENDERMODE_INSTANCED
+				 && instance_renderer.isSupported())
+		{
+			glEnable(GL_DEPTH_TEST);
+			instance_renderer.draw(box_mesh, 36);
+		}
+		else
 		{
 			glEnable(GL_DEPTH_TEST);
 
-			const vector<VoxelData>& arr = voxels.getVoxels();
-
-			for (int i = 0; i < arr.size(); i++)
+			voxels.forEach([&](const VoxelData& v)
 			{
-				const VoxelData& v = arr[i];
-
-				glPushName(i);
 				drawVoxelData(v, true);
-				glPopName();
-			}
+			});
 		}
 
 		glPopMatrix();
@@ -506,11 +664,8 @@ private:
 
 			ofFill();
 
-			float handle_size = 0.2;
 			bool inv = ofGetModifierPressed(OF_KEY_SHIFT);
 
-			glPushName(HANDLE_TAG);
-
 			// X
 			ofPushMatrix();
 			ofSetColor(255, 0, 0);
@@ -519,9 +674,7 @@ private:
 			drawHandleArrow(inv);
 
 			billboard();
-			glPushName(HANDLE_X_TAG);
-			ofCircle(0, 0, handle_size);
-			glPopName();
+			ofCircle(0, 0, HANDLE_SIZE);
 			ofPopMatrix();
 
 			// Y
@@ -532,9 +685,7 @@ private:
 			drawHandleArrow(inv, ofQuaternion(90, ofVec3f(0, 0, 1)));
 
 			billboard();
-			glPushName(HANDLE_Y_TAG);
-			ofCircle(0, 0, handle_size);
-			glPopName();
+			ofCircle(0, 0, HANDLE_SIZE);
 			ofPopMatrix();
 
 			// Z
@@ -545,9 +696,7 @@ private:
 			drawHandleArrow(inv, ofQuaternion(90, ofVec3f(0, -1, 0)));
 
 			billboard();
-			glPushName(HANDLE_Z_TAG);
-			ofCircle(0, 0, handle_size);
-			glPopName();
+			ofCircle(0, 0, HANDLE_SIZE);
 			ofPopMatrix();
 
 			// -X
@@ -558,9 +707,7 @@ private:
 			drawHandleArrow(inv, ofQuaternion(180, ofVec3f(0, 0, 1)));
 
 			billboard();
-			glPushName(HANDLE_NEG_X_TAG);
-			ofCircle(0, 0, handle_size);
-			glPopName();
+			ofCircle(0, 0, HANDLE_SIZE);
 			ofPopMatrix();
 
 			// -Y
@@ -571,9 +718,7 @@ private:
 			drawHandleArrow(inv, ofQuaternion(90, ofVec3f(0, 0, -1)));
 
 			billboard();
-			glPushName(HANDLE_NEG_Y_TAG);
-			ofCircle(0, 0, handle_size);
-			glPopName();
+			ofCircle(0, 0, HANDLE_SIZE);
 			ofPopMatrix();
 
 			// -Z
@@ -584,13 +729,54 @@ private:
 			drawHandleArrow(inv, ofQuaternion(90, ofVec3f(0, 1, 0)));
 
 			billboard();
-			glPushName(HANDLE_NEG_Z_TAG);
-			ofCircle(0, 0, handle_size);
-			glPopName();
+			ofCircle(0, 0, HANDLE_SIZE);
 			ofPopMatrix();
+		}
+	}
 
-			glPopName();
+	void drawRenderStats()
+	{
+		char buf[256];
+		
+		if (rendermode == RENDERMODE_MESH)
+		{
+			const VoxelMeshStats& st = mesh_renderer.getStats();
+			snprintf(buf, sizeof(buf), "mesh: %lu tris (boxes: %lu), %lu/%lu chunks built in %.2f ms, level %d%s",
+					 (unsigned long)st.num_triangles, (unsigned long)st.box_triangles,
+					 (unsigned long)st.chunks_built, (unsigned long)st.num_chunks, st.build_ms,
+					 st.level, lod ? "" : " (lod off)");
 		}
+		else
+		{
+			snprintf(buf, sizeof(buf), "%s: %lu tris",
+					 rendermode == RENDERMODE_INSTANCED ? "instanced" : "boxes",
+					 (unsigned long)voxels.size() * 12);
+		}
+		
+		ofSetColor(255);
+		ofDrawBitmapString(buf, 4, ofGetHeight() - 8);
+	}
+
+	void drawTaskProgress()
+	{
+		if (!task.isRunning()) return;
+		
+		const int w = 300, h = 20;
+		int x = (ofGetWidth() - w) / 2;
+		int y = ofGetHeight() - 40;
+		
+		ofFill();
+		ofSetColor(0, 160);
+		ofRect(x, y, w, h);
+		ofSetColor(255, 96);
+		ofRect(x, y, w * ofClamp(task.getProgress(), 0, 1), h);
+		
+		char buf[256];
+		snprintf(buf, sizeof(buf), "%s %d%%%s%s", task.getName().c_str(), (int)(task.getProgress() * 100),
+				 task.isCancelled() ? " (cancelling)" : "", isReadOnly() ? ", read only" : "");
+		
+		ofSetColor(255);
+		ofDrawBitmapString(buf, x + 6, y + 14);
 	}
 
 	void drawCursor()
@@ -610,95 +796,131 @@ private:  // hittest
 	GLdouble modelview[16], projection[16];
 	GLint viewport[4];
 
-	struct Selection
-	{
-		GLfloat min_depth, max_depth;
-		vector<GLuint> name_stack;
+	VoxelPicker voxel_picker;
 
-		static bool sort_by_depth(const Selection& a, const Selection& b)
-		{
-			return a.min_depth < b.min_depth;
-		}
-	};
+	// the mouse ray in grid space, from the matrices cached by draw()
+	void mouseRay(int x, int y, ofVec3f& origin, ofVec3f& dir)
+	{
+		GLdouble nx = 0, ny = 0, nz = 0;
+		GLdouble fx = 0, fy = 0, fz = 0;
+
+		gluUnProject(x, viewport[3] - y, 0,
+					 modelview, projection, viewport,
+					 &nx, &ny, &nz);
+		gluUnProject(x, viewport[3] - y, 1,
+					 modelview, projection, viewport,
+					 &fx, &fy, &fz);
+
+		origin.set(nx, ny, nz);
+		dir.set(fx - nx, fy - ny, fz - nz);
+		dir.normalize();
+	}
 
-	vector<Selection> pickup(int x, int y);
-	vector<GLuint> hittest(int x, int y, unsigned int tag_name);
+	bool pickVoxel(int x, int y, VoxelPick& hit)
+	{
+		ofVec3f origin, dir;
+		mouseRay(x, y, origin, dir);
+		return voxel_picker.pick(voxels, origin, dir, hit);
+	}
 
-	VoxelData* voxel_hittest(int x, int y)
+	// copies the voxel under the mouse into v, returns &v or NULL
+	VoxelData* voxel_hittest(int x, int y, VoxelData& v)
 	{
-		// TODO: cache name_stack on frame
-		vector<GLuint> name_stack = hittest(x, y, VOXEL_TAG);
-		if (name_stack.size() != 2) return NULL;
+		VOXEL_PROFILE("pick");
+		VoxelProfiler::get().count("pick calls");
 
-		unsigned int oid = name_stack[1];
-		VoxelData& voxel = voxels.getVoxels().at(oid);
-		return &voxel;
+		VoxelPick hit;
+		if (!pickVoxel(x, y, hit)) return NULL;
+		v = hit.voxel;
+		return &v;
 	}
 
-	unsigned int handle_hittest(int x, int y)
+	static bool isSameVoxel(const VoxelData& a, const VoxelData& b)
 	{
-		vector<GLuint> name_stack = hittest(x, y, HANDLE_TAG);
-		if (name_stack.size() != 2) return 0;
-		return name_stack[1];
+		return a.x == b.x && a.y == b.y && a.z == b.z
+			&& a.w == b.w && a.h == b.h && a.d == b.d;
 	}
-	
-	bool put_voxel_hittest(int x, int y)
+
+	// a load or import swaps in a new model when it finishes, edits made
+	// meanwhile would be lost. the model is read only until then.
+	bool isReadOnly() const
 	{
-		vector<Selection> picked_stack = pickup(x, y);
-		if (picked_stack.empty()) return false;
-		
-		Selection &sel = picked_stack[0];
-		
-		if (sel.name_stack[0] != VOXEL_TAG) return false;
-		
-		unsigned int oid = sel.name_stack[1];
-		VoxelData& v = voxels.getVoxels().at(oid);
-		
-		ofVec3f p(v.x + 0.5, v.y + 0.5, v.z + 0.5);
-		
-		GLdouble ox = 0, oy = 0, oz = 0;
-		GLdouble vx = 0, vy = 0, vz = 0;
-		
-		gluProject(p.x, p.y, p.z,
-				   modelview, projection, viewport,
-				   &vx, &vy, &vz);
-		
-		vy = ofGetHeight() - vy;
-		
+		return task.isRunning() && task_kind != TASK_SAVE;
+	}
+
+	// copies the selected voxel as the model has it now, for an edit.
+	// false, and nothing selected, if the voxel is gone.
+	bool editSelected(VoxelData& v)
+	{
+		if (selected_voxel == NULL || isReadOnly()) return false;
+
+		VoxelRegion cell = { selected.x, selected.y, selected.z, selected.x + 1, selected.y + 1, selected.z + 1 };
+		vector<VoxelData> found;
+		voxels.query(cell, found);
+
+		for (int i = 0; i < found.size(); i++)
 		{
-			gluUnProject(x, ofGetHeight() - y, sel.min_depth,
-						 modelview, projection, viewport,
-						 &ox, &oy, &oz);
-			
-			ofVec3f axis = (p - ofVec3f(ox, oy, oz));
-			ofVec3f norm(fabs(axis.x), fabs(axis.y), fabs(axis.z));
-			
-			if (norm.x > max(norm.y, norm.z))
-			{
-				if (axis.x > 0)
-					p.x -= 1;
-				else
-					p.x += 1;
-			}
-			else if (norm.y > max(norm.x, norm.z))
+			if (isSameVoxel(found[i], selected))
 			{
-				if (axis.y > 0)
-					p.y -= 1;
-				else
-					p.y += 1;
+				selected = v = found[i];
+				return true;
 			}
-			else if(norm.z > max(norm.x, norm.y))
+		}
+
+		selected_voxel = NULL;
+		return false;
+	}
+
+	// handles are drawn on top of everything, so they are tested on their own
+	unsigned int handle_hittest(int x, int y)
+	{
+		if ((editmode == EDITMODE_MOVE
+			 || editmode == EDITMODE_RESIZE) == false) return 0;
+		if (selected_voxel == NULL) return 0;
+
+		const VoxelData* v = selected_voxel;
+
+		const unsigned int tags[6] = {
+			HANDLE_X_TAG, HANDLE_Y_TAG, HANDLE_Z_TAG,
+			HANDLE_NEG_X_TAG, HANDLE_NEG_Y_TAG, HANDLE_NEG_Z_TAG
+		};
+
+		ofVec3f c = v->center();
+		ofVec3f half(v->w * 0.5, v->h * 0.5, v->d * 0.5);
+
+		ofVec3f origin, dir;
+		mouseRay(x, y, origin, dir);
+
+		unsigned int handle = 0;
+		float nearest = FLT_MAX;
+
+		for (int i = 0; i < 6; i++)
+		{
+			ofVec3f p = c;
+			int axis = i % 3;
+			p[axis] += (i < 3) ? half[axis] : -half[axis];
+
+			float t;
+			if (VoxelPicker::intersectSphere(origin, dir, p, HANDLE_SIZE, t) && t < nearest)
 			{
-				if (axis.z > 0)
-					p.z -= 1;
-				else
-					p.z += 1;
+				nearest = t;
+				handle = tags[i];
 			}
-			
-			cursor.x = floor(p.x);
-			cursor.y = floor(p.y);
-			cursor.z = floor(p.z);
 		}
+
+		return handle;
+	}
+	
+	// moves the cursor to the empty cell in front of the face under the mouse
+	bool put_voxel_hittest(int x, int y)
+	{
+		VoxelPick hit;
+		if (!pickVoxel(x, y, hit)) return false;
+		if (hit.normal == ofVec3f(0, 0, 0)) return false;
+		
+		cursor.x = hit.x + hit.normal.x;
+		cursor.y = hit.y + hit.normal.y;
+		cursor.z = hit.z + hit.normal.z;
 		
 		return true;
 	}
@@ -706,6 +928,9 @@ private:  // hittest
 private:
 	ofVbo box_mesh;
 	ofVbo box_wireframe_mesh;
+	
+	VoxelInstanceRenderer instance_renderer;
+	VoxelMeshRenderer mesh_renderer;
 
 	void setupMesh()
 	{
@@ -773,6 +998,8 @@ private:
 				box_wireframe_mesh.setMesh(mesh, GL_STATIC_DRAW);
 			}
 		}
+		
+		instance_renderer.setup();
 	}
 
 	void drawVoxelData(const VoxelData& voxel, bool fill = true,
@@ -828,15 +1055,29 @@ private: // UI
 		{
 			ofxControlButton *o;
 			
-			o = c.addButton("save json");
+			o = c.addButton("save");
 			ofAddListener(o->pressed, this, &Editor::onSavePressed);
 			
-			o = c.addButton("load json");
+			o = c.addButton("save json v2");
+			o->setToggle(true);
+			ofAddListener(o->pressed, this, &Editor::onJsonVersionPressed);
+			
+			o = c.addButton("load");
 			ofAddListener(o->pressed, this, &Editor::onLoadPressed);
 			
             o = c.addButton("load *.obj");
             ofAddListener(o->pressed, this, &Editor::onLoadObjPressed);
             
+            o = c.addButton("full resolution");
+            ofAddListener(o->pressed, this, &Editor::onFullResolutionPressed);
+            
+            o = c.addButton("solid *.obj");
+            o->setToggle(true);
+            ofAddListener(o->pressed, this, &Editor::onSolidObjPressed);
+            
+            o = c.addButton("cancel");
+            ofAddListener(o->pressed, this, &Editor::onCancelPressed);
+            
 			c.addSeparator();
 			
 			o = c.addButton("clear");
@@ -845,6 +1086,9 @@ private: // UI
 			o = c.addButton("undo");
 			ofAddListener(o->pressed, this, &Editor::onUndo);
 			
+			o = c.addButton("redo");
+			ofAddListener(o->pressed, this, &Editor::onRedo);
+			
 			c.addSeparator();
 			
 			tool_group.clear();
@@ -981,38 +1225,90 @@ private: // UI
 		
 		picker->setValue(c.getHex());
 		
-		if (selected_voxel)
+		if (selected_voxel && selected_voxel->color != c)
 		{
-			selected_voxel->color = c;
+			VoxelData target;
+			if (editSelected(target))
+			{
+				VoxelData v = target;
+				v.color = c;
+				
+				VoxelData stored;
+				if (voxels.update(target, v, &stored))
+				{
+					history.updateColor(target, stored);
+					selected = stored;
+				}
+			}
 		}
 	}
 	
 	string json_filename;
+	int json_version; // 1 unless "save json v2" is on, see VoxelJson.h
+	
+	// an obj model shown as a preview, kept until its full resolution pass
+	enum { PREVIEW_FACES = 50000 };
+	VoxelObjImporter obj_importer;
+	VoxelImportOptions obj_options;
+	
+	// loads, saves and imports run here, one at a time. declared after the
+	// importer so the worker is gone before the importer it uses.
+	enum TaskKind { TASK_LOAD, TASK_SAVE, TASK_OBJ } task_kind;
+	VoxelTask task;
+	string task_filename;
 
 	void onSavePressed(ofEventArgs&)
 	{
+		if (task.isRunning()) return;
+		
 		ofFileDialogResult result = ofSystemSaveDialog(json_filename, "");
 		if (result.bSuccess)
 		{
-			voxels.save(result.getPath());
+			// saved from a copy, editing can go on. the file is written
+			// next to the target and moved over it only once complete.
+			string path = result.getPath();
+			int version = json_version;
+			
+			task_kind = TASK_SAVE;
+			task.start("saving " + result.getName(), [path, version](Voxel& v, const VoxelProgress& progress)
+			{
+				string part = path + ".part";
+				bool ok = Voxel::isBinaryPath(path) ? v.saveBinary(part, progress) : v.save(part, version, progress);
+				
+				if (ok) ok = ofFile::moveFromTo(part, path, false, true);
+				if (!ok) ofFile::removeFile(part, false);
+				return ok;
+			}, voxels);
 		}
 	}
 	
+	void onJsonVersionPressed(const void* sender, ofEventArgs&)
+	{
+		json_version = json_version == 1 ? 2 : 1;
+		((ofxControlButton*)sender)->setValue(json_version == 2);
+	}
+	
 	void onLoadPressed(ofEventArgs&)
 	{
+		if (task.isRunning()) return;
+		
 		ofFileDialogResult result = ofSystemLoadDialog();
 		if (result.bSuccess)
 		{
-			string ext = ofFilePath::getFileExt(result.getName());
-			bool loaded = false;
+			string ext = ofToLower(ofFilePath::getFileExt(result.getName()));
 			
-			if (ext == "json")
+			if (ext == "json" || ext == "vxb")
 			{
-				json_filename = result.getName();
-				loaded = voxels.load(result.getPath());
+				string path = result.getPath();
+				
+				task_kind = TASK_LOAD;
+				task_filename = result.getName();
+				task.start("loading " + result.getName(), [path](Voxel& v, const VoxelProgress& progress)
+				{
+					return v.loadFile(path, progress);
+				});
 			}
-			
-			if (!loaded)
+			else
 			{
 				ofSystemAlertDialog("Invalid file format");
 			}
@@ -1021,39 +1317,141 @@ private: // UI
     
     void onLoadObjPressed(ofEventArgs&)
     {
+        if (task.isRunning()) return;
+        
         ofFileDialogResult result = ofSystemLoadDialog();
         if (result.bSuccess)
         {
-            string ext = ofFilePath::getFileExt(result.getName());
-            bool loaded = false;
+            string ext = ofToLower(ofFilePath::getFileExt(result.getName()));
             
             if (ext == "obj")
             {
-                loaded = voxels.loadObj(result.getPath());
+                string path = result.getPath();
+                VoxelObjImporter* importer = &obj_importer;
+                VoxelImportOptions options = obj_options;
+                
+                task_kind = TASK_OBJ;
+                task.start("importing " + result.getName(), [=](Voxel& v, const VoxelProgress& progress)
+                {
+                    if (!importer->open(path)) return false;
+                    
+                    // large models come in as a coarse preview first, the full
+                    // resolution pass runs on demand
+                    if (importer->getNumFaces() > PREVIEW_FACES)
+                        return v.loadObj(*importer, options.preview(), progress);
+                    
+                    bool ok = v.loadObj(*importer, options, progress);
+                    importer->close();
+                    return ok;
+                });
             }
-            
-            if (!loaded)
+            else
             {
                 ofSystemAlertDialog("Invalid file format");
             }
         }
 
+    }
+    
+    void onSolidObjPressed(const void* sender, ofEventArgs&)
+    {
+        obj_options.solid = !obj_options.solid;
+        ((ofxControlButton*)sender)->setValue(obj_options.solid);
+    }
+    
+    void onFullResolutionPressed(ofEventArgs&)
+    {
+        if (task.isRunning() || !obj_importer.isOpen()) return;
+        
+        VoxelObjImporter* importer = &obj_importer;
+        VoxelImportOptions options = obj_options;
+        
+        task_kind = TASK_OBJ;
+        task.start("voxelizing at full resolution", [=](Voxel& v, const VoxelProgress& progress)
+        {
+            bool ok = v.loadObj(*importer, options, progress);
+            if (ok) importer->close();
+            return ok;
+        });
+    }
+    
+    void onCancelPressed(ofEventArgs&)
+    {
+        task.cancel();
+    }
+    
+    // called from update(), picks up a finished task on the main thread
+    void updateTask()
+    {
+        VoxelTask::State state = task.poll();
+        if (state == VoxelTask::IDLE || state == VoxelTask::RUNNING) return;
+        
+        const char* gauge = task_kind == TASK_SAVE ? "save ms" : task_kind == TASK_OBJ ? "import ms" : "load ms";
+        VoxelProfiler::get().gauge(gauge, task.getElapsedMillis());
+        
+        if (state == VoxelTask::DONE && task_kind != TASK_SAVE)
+        {
+            voxels.swap(task.getResult());
+            
+            history.clear();
+            selected_voxel = NULL;
+            focused_voxel = NULL;
+            half_selected_voxel = NULL;
+            
+            if (task_kind == TASK_LOAD)
+            {
+                json_filename = task_filename;
+                obj_importer.close();
+            }
+            
+            journal.reset(voxels);
+        }
+        
+        // a failed or cancelled import leaves nothing to refine
+        if (state != VoxelTask::DONE && task_kind == TASK_OBJ)
+            obj_importer.close();
+        
+        task.clearResult();
+        
+        if (state == VoxelTask::FAILED)
+        {
+            ofSystemAlertDialog(task_kind == TASK_SAVE ? "Could not save the file" : "Invalid file format");
+        }
     }
 	
 	void onClear(ofEventArgs&)
 	{
+		if (isReadOnly()) return;
+		
+		history.removeAll(voxels);
+		
 		voxels.clear();
 		selected_voxel = NULL;
+		focused_voxel = NULL;
 		half_selected_voxel = NULL;
 	}
 	
 	void onUndo(ofEventArgs&)
 	{
-		if (!undo_buffer.empty())
+		if (isReadOnly()) return;
+		
+		if (history.undo(voxels))
+		{
+			selected_voxel = NULL;
+			focused_voxel = NULL;
+			half_selected_voxel = NULL;
+		}
+	}
+	
+	void onRedo(ofEventArgs&)
+	{
+		if (isReadOnly()) return;
+		
+		if (history.redo(voxels))
 		{
-			Voxel data = undo_buffer.back();
-			undo_buffer.pop_back();
-			voxels = data;
+			selected_voxel = NULL;
+			focused_voxel = NULL;
+			half_selected_voxel = NULL;
 		}
 	}
 	
@@ -1110,107 +1508,6 @@ private: // UI
 		}
 	}
 
-	deque<Voxel> undo_buffer;
-	
-	void pushUndoBuffer()
-	{
-		undo_buffer.push_back(voxels);
-		
-		if (undo_buffer.size() > 30)
-		{
-			undo_buffer.pop_front();
-		}
-	}
+	VoxelJournal journal;
+	VoxelHistory history;
 };
-
-inline vector<Editor::Selection> Editor::pickup(int x, int y)
-{
-	const int BUFSIZE = 256;
-	GLuint selectBuf[BUFSIZE];
-	GLint hits;
-
-	glPushAttrib(GL_ALL_ATTRIB_BITS);
-
-	glSelectBuffer(BUFSIZE, selectBuf);
-	glRenderMode(GL_SELECT);
-	glMatrixMode(GL_PROJECTION);
-
-	glPushMatrix();
-	{
-		glEnable(GL_DEPTH_TEST);
-
-		glLoadIdentity();
-		gluPickMatrix(x, viewport[3] - y, 1.0, 1.0, viewport);
-		glMultMatrixd(projection);
-
-		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
-		glMultMatrixd(modelview);
-
-		glPushName(FLOOR_TAG);
-		drawFloor();
-		glPopName();
-
-		glPushName(VOXEL_TAG);
-		drawVoxel();
-		glPopName();
-
-		glDisable(GL_DEPTH_TEST);
-		drawHandle();
-
-		glMatrixMode(GL_PROJECTION);
-	}
-	glPopMatrix();
-
-	glMatrixMode(GL_MODELVIEW);
-
-	hits = glRenderMode(GL_RENDER);
-
-	glPopAttrib();
-
-	if (hits <= 0) return vector<Selection>();
-
-	GLuint* ptr = selectBuf;
-
-	vector<Selection> picked_stack;
-
-	for (int i = 0; i < hits; i++)
-	{
-		GLuint num_names = ptr[0];
-		GLfloat min_depth = (GLfloat)ptr[1] / 0xffffffff;
-		GLfloat max_depth = (GLfloat)ptr[2] / 0xffffffff;
-
-		GLuint* names = &ptr[3];
-
-		Selection d;
-
-		d.min_depth = min_depth;
-		d.max_depth = max_depth;
-		d.name_stack.insert(d.name_stack.begin(), names, (names + num_names));
-
-		picked_stack.push_back(d);
-
-		ptr += (3 + num_names);
-	}
-
-	sort(picked_stack.begin(), picked_stack.end(), Selection::sort_by_depth);
-
-	return picked_stack;
-}
-
-inline vector<GLuint> Editor::hittest(int x, int y, unsigned int tag_name)
-{
-	vector<Selection> picked_stack = pickup(x, y);
-	if (picked_stack.empty()) return vector<GLuint>();
-
-	for (int i = 0; i < picked_stack.size(); i++)
-	{
-		const Selection& s = picked_stack[i];
-		if (s.name_stack[0] == tag_name)
-		{
-			return s.name_stack;
-		}
-	}
-
-	return vector<GLuint>();
-}
\ No newline at end of file
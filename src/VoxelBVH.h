@@ -0,0 +1,585 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <algorithm>
+
+// bounding volume hierarchy over integer boxes, one leaf per item. items are
+// small dense ints (the owner's voxel index). leaves are stored fattened by
+// MARGIN cells so a box nudged by a handle usually stays inside its leaf and
+// update() is free; otherwise the leaf is pulled out and reinserted. inserts
+// pick the sibling by surface area and the tree is kept balanced by AVL
+// style rotations, build() splits boxes sorted along a z-order curve.
+class VoxelBVH
+{
+public:
+
+	enum { MARGIN = 1 };
+
+	VoxelBVH() : root(-1), free_list(-1), num_items(0) {}
+
+	void clear()
+	{
+		nodes.clear();
+		item_leaf.clear();
+		root = -1;
+		free_list = -1;
+		num_items = 0;
+	}
+
+	size_t size() const { return num_items; }
+	int getHeight() const { return root < 0 ? 0 : nodes[root].height; }
+
+	size_t memoryUsage() const
+	{
+		return nodes.capacity() * sizeof(Node) + item_leaf.capacity() * sizeof(int);
+	}
+
+	// replaces the tree. box(i, x, y, z, w, h, d) fills in the box of item i
+	template <typename F>
+	void build(int n, F box)
+	{
+		clear();
+		if (n == 0) return;
+
+		nodes.reserve(n * 2);
+		item_leaf.assign(n, -1);
+
+		vector<BuildItem> items(n);
+		for (int i = 0; i < n; i++)
+		{
+			int x, y, z, w, h, d;
+			box(i, x, y, z, w, h, d);
+
+			BuildItem& b = items[i];
+			b.key = morton(x + w / 2, y + h / 2, z + d / 2);
+			b.leaf = newLeaf(i, x, y, z, w, h, d);
+		}
+
+		// neighbours on the z-order curve are neighbours in space, so
+		// halving the sorted range gives a reasonable tree in one sort
+		std::sort(items.begin(), items.end());
+
+		num_items = n;
+		root = buildRange(items, 0, n);
+		nodes[root].parent = -1;
+	}
+
+	void insert(int item, int x, int y, int z, int w, int h, int d)
+	{
+		if (item >= (int)item_leaf.size()) item_leaf.resize(item + 1, -1);
+		if (item_leaf[item] >= 0) remove(item);
+
+		int leaf = newLeaf(item, x, y, z, w, h, d);
+		insertLeaf(leaf);
+		num_items++;
+	}
+
+	void remove(int item)
+	{
+		if (item < 0 || item >= (int)item_leaf.size()) return;
+
+		int leaf = item_leaf[item];
+		if (leaf < 0) return;
+
+		removeLeaf(leaf);
+		freeNode(leaf);
+		item_leaf[item] = -1;
+		num_items--;
+	}
+
+	// returns true if the leaf had to be reinserted
+	bool update(int item, int x, int y, int z, int w, int h, int d)
+	{
+		if (item < 0 || item >= (int)item_leaf.size() || item_leaf[item] < 0)
+		{
+			insert(item, x, y, z, w, h, d);
+			return true;
+		}
+
+		const Node& n = nodes[item_leaf[item]];
+		if (n.lo[0] <= x && n.lo[1] <= y && n.lo[2] <= z
+			&& x + w <= n.hi[0] && y + h <= n.hi[1] && z + d <= n.hi[2]) return false;
+
+		remove(item);
+		insert(item, x, y, z, w, h, d);
+		return true;
+	}
+
+	// item `from` is now called `to`, for owners that swap and pop
+	void rename(int from, int to)
+	{
+		if (from < 0 || from >= (int)item_leaf.size()) return;
+
+		int leaf = item_leaf[from];
+		item_leaf[from] = -1;
+		if (leaf < 0) return;
+
+		if (to >= (int)item_leaf.size()) item_leaf.resize(to + 1, -1);
+		item_leaf[to] = leaf;
+		nodes[leaf].item = to;
+	}
+
+	// loose bounds of everything, half open
+	bool getBounds(int lo[3], int hi[3]) const
+	{
+		if (root < 0) return false;
+		for (int a = 0; a < 3; a++)
+		{
+			lo[a] = nodes[root].lo[a];
+			hi[a] = nodes[root].hi[a];
+		}
+		return true;
+	}
+
+	// f(item) for every leaf whose fattened box overlaps [x0, x1) x ...,
+	// the caller checks the exact box. return false from f to stop.
+	template <typename F>
+	void query(int x0, int y0, int z0, int x1, int y1, int z1, F f) const
+	{
+		if (root < 0) return;
+
+		int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = root;
+
+		while (top > 0)
+		{
+			const Node& n = nodes[stack[--top]];
+
+			if (n.lo[0] >= x1 || n.hi[0] <= x0
+				|| n.lo[1] >= y1 || n.hi[1] <= y0
+				|| n.lo[2] >= z1 || n.hi[2] <= z0) continue;
+
+			if (n.item >= 0)
+			{
+				if (!f(n.item)) return;
+			}
+			else
+			{
+				stack[top++] = n.child[0];
+				stack[top++] = n.child[1];
+			}
+		}
+	}
+
+	// f(item, max_t) for leaves along the ray, nearest subtree first. f
+	// returns the distance of its exact hit if that is closer than max_t,
+	// else max_t; subtrees beyond the returned distance are skipped.
+	// dir doesn't need to be normalized.
+	template <typename F>
+	void raycast(const ofVec3f& origin, const ofVec3f& dir, float max_t, F f) const
+	{
+		if (root < 0) return;
+
+		ofVec3f inv_dir(1 / dir.x, 1 / dir.y, 1 / dir.z);
+
+		int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = root;
+
+		while (top > 0)
+		{
+			int i = stack[--top];
+			const Node& n = nodes[i];
+
+			float t;
+			if (!slab(n, origin, inv_dir, max_t, t)) continue;
+
+			if (n.item >= 0)
+			{
+				max_t = f(n.item, max_t);
+				continue;
+			}
+
+			float t0, t1;
+			bool hit0 = slab(nodes[n.child[0]], origin, inv_dir, max_t, t0);
+			bool hit1 = slab(nodes[n.child[1]], origin, inv_dir, max_t, t1);
+
+			// the farther child goes on the stack first
+			if (hit0 && hit1)
+			{
+				if (t0 <= t1)
+				{
+					stack[top++] = n.child[1];
+					stack[top++] = n.child[0];
+				}
+				else
+				{
+					stack[top++] = n.child[0];
+					stack[top++] = n.child[1];
+				}
+			}
+			else if (hit0) stack[top++] = n.child[0];
+			else if (hit1) stack[top++] = n.child[1];
+		}
+	}
+
+	// slab test. t is where the ray enters the box (0 if it starts inside),
+	// normal the face it enters through
+	static bool intersectBox(const ofVec3f& origin, const ofVec3f& dir,
+							 const ofVec3f& min, const ofVec3f& max,
+							 float& t, ofVec3f& normal)
+	{
+		float t_near = -FLT_MAX, t_far = FLT_MAX;
+		int near_axis = -1;
+
+		for (int a = 0; a < 3; a++)
+		{
+			if (dir[a] == 0)
+			{
+				if (origin[a] < min[a] || origin[a] > max[a]) return false;
+				continue;
+			}
+
+			float t1 = (min[a] - origin[a]) / dir[a];
+			float t2 = (max[a] - origin[a]) / dir[a];
+			if (t1 > t2) swap(t1, t2);
+
+			if (t1 > t_near)
+			{
+				t_near = t1;
+				near_axis = a;
+			}
+			t_far = std::min(t_far, t2);
+
+			if (t_near > t_far) return false;
+		}
+
+		if (t_far < 0) return false;
+
+		normal.set(0, 0, 0);
+
+		if (t_near < 0)
+		{
+			t = 0;
+		}
+		else
+		{
+			t = t_near;
+			normal[near_axis] = dir[near_axis] > 0 ? -1 : 1;
+		}
+
+		return true;
+	}
+
+private:
+
+	// enough for any tree the rotations leave us with
+	enum { STACK_SIZE = 256 };
+
+	struct Node
+	{
+		int lo[3], hi[3];
+		int parent; // next free node while on the free list
+		int child[2];
+		int item;   // -1 for inner nodes
+		int height; // 0 for leaves
+	};
+
+	vector<Node> nodes;
+	vector<int> item_leaf;
+	int root;
+	int free_list;
+	size_t num_items;
+
+	int allocNode()
+	{
+		if (free_list >= 0)
+		{
+			int i = free_list;
+			free_list = nodes[i].parent;
+			return i;
+		}
+
+		nodes.push_back(Node());
+		return nodes.size() - 1;
+	}
+
+	void freeNode(int i)
+	{
+		nodes[i].parent = free_list;
+		nodes[i].height = -1;
+		free_list = i;
+	}
+
+	int newLeaf(int item, int x, int y, int z, int w, int h, int d)
+	{
+		int i = allocNode();
+		Node& n = nodes[i];
+
+		n.lo[0] = x - MARGIN;
+		n.lo[1] = y - MARGIN;
+		n.lo[2] = z - MARGIN;
+		n.hi[0] = x + w + MARGIN;
+		n.hi[1] = y + h + MARGIN;
+		n.hi[2] = z + d + MARGIN;
+		n.parent = -1;
+		n.child[0] = n.child[1] = -1;
+		n.item = item;
+		n.height = 0;
+
+		item_leaf[item] = i;
+		return i;
+	}
+
+	void fit(int i)
+	{
+		Node& n = nodes[i];
+		const Node& a = nodes[n.child[0]];
+		const Node& b = nodes[n.child[1]];
+
+		for (int k = 0; k < 3; k++)
+		{
+			n.lo[k] = std::min(a.lo[k], b.lo[k]);
+			n.hi[k] = std::max(a.hi[k], b.hi[k]);
+		}
+		n.height = 1 + std::max(a.height, b.height);
+	}
+
+	static long long area(const int lo[3], const int hi[3])
+	{
+		long long dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+		return 2 * (dx * dy + dy * dz + dz * dx);
+	}
+
+	static long long unionArea(const Node& a, const Node& b)
+	{
+		int lo[3], hi[3];
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = std::min(a.lo[k], b.lo[k]);
+			hi[k] = std::max(a.hi[k], b.hi[k]);
+		}
+		return area(lo, hi);
+	}
+
+	struct BuildItem
+	{
+		uint64_t key;
+		int leaf;
+
+		bool operator<(const BuildItem& o) const { return key < o.key; }
+	};
+
+	// interleaves 21 bits of each coordinate, same range as VoxelIndex
+	static uint64_t morton(int x, int y, int z)
+	{
+		return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+	}
+
+	static uint64_t spread(int v)
+	{
+		uint64_t x = (uint32_t)(v + (1 << 20)) & 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffffULL;
+		x = (x | x << 16) & 0x1f0000ff0000ffULL;
+		x = (x | x << 8) & 0x100f00f00f00f00fULL;
+		x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+		x = (x | x << 2) & 0x1249249249249249ULL;
+		return x;
+	}
+
+	// first item whose key differs from items[begin] in the highest bit
+	// that varies over the range, i.e. the spatial midpoint
+	static int split(const vector<BuildItem>& items, int begin, int end)
+	{
+		uint64_t first = items[begin].key, last = items[end - 1].key;
+		if (first == last) return (begin + end) / 2;
+
+		uint64_t bit = 1ULL << 63;
+		while (((first ^ last) & bit) == 0) bit >>= 1;
+
+		int lo = begin, hi = end - 1;
+		while (lo + 1 < hi)
+		{
+			int m = (lo + hi) / 2;
+			if (items[m].key & bit) hi = m;
+			else lo = m;
+		}
+		return hi;
+	}
+
+	int buildRange(const vector<BuildItem>& items, int begin, int end)
+	{
+		if (end - begin == 1) return items[begin].leaf;
+
+		int mid = split(items, begin, end);
+		int left = buildRange(items, begin, mid);
+		int right = buildRange(items, mid, end);
+
+		int i = allocNode();
+		Node& n = nodes[i];
+		n.child[0] = left;
+		n.child[1] = right;
+		n.item = -1;
+		nodes[left].parent = i;
+		nodes[right].parent = i;
+		fit(i);
+
+		return i;
+	}
+
+	void insertLeaf(int leaf)
+	{
+		if (root < 0)
+		{
+			root = leaf;
+			nodes[leaf].parent = -1;
+			return;
+		}
+
+		// walk down to the sibling that grows the tree least
+		int i = root;
+		while (nodes[i].item < 0)
+		{
+			const Node& n = nodes[i];
+			const Node& l = nodes[leaf];
+
+			long long a = area(n.lo, n.hi);
+			long long combined = unionArea(n, l);
+
+			long long cost = 2 * combined;
+			long long inherited = 2 * (combined - a);
+
+			long long cost_child[2];
+			for (int k = 0; k < 2; k++)
+			{
+				const Node& c = nodes[n.child[k]];
+				cost_child[k] = unionArea(c, l) + inherited;
+				if (c.item < 0) cost_child[k] -= area(c.lo, c.hi);
+			}
+
+			if (cost < cost_child[0] && cost < cost_child[1]) break;
+
+			i = cost_child[0] < cost_child[1] ? n.child[0] : n.child[1];
+		}
+
+		int sibling = i;
+		int old_parent = nodes[sibling].parent;
+		int new_parent = allocNode();
+
+		Node& p = nodes[new_parent];
+		p.parent = old_parent;
+		p.child[0] = sibling;
+		p.child[1] = leaf;
+		p.item = -1;
+		nodes[sibling].parent = new_parent;
+		nodes[leaf].parent = new_parent;
+
+		if (old_parent >= 0) replaceChild(old_parent, sibling, new_parent);
+		else root = new_parent;
+
+		refitUp(new_parent);
+	}
+
+	void removeLeaf(int leaf)
+	{
+		if (leaf == root)
+		{
+			root = -1;
+			return;
+		}
+
+		int parent = nodes[leaf].parent;
+		int grand_parent = nodes[parent].parent;
+		int sibling = nodes[parent].child[0] == leaf ? nodes[parent].child[1] : nodes[parent].child[0];
+
+		if (grand_parent >= 0)
+		{
+			replaceChild(grand_parent, parent, sibling);
+			nodes[sibling].parent = grand_parent;
+			freeNode(parent);
+			refitUp(grand_parent);
+		}
+		else
+		{
+			root = sibling;
+			nodes[sibling].parent = -1;
+			freeNode(parent);
+		}
+	}
+
+	void replaceChild(int parent, int from, int to)
+	{
+		Node& p = nodes[parent];
+		if (p.child[0] == from) p.child[0] = to;
+		else p.child[1] = to;
+	}
+
+	void refitUp(int i)
+	{
+		while (i >= 0)
+		{
+			fit(i);
+			i = balance(i);
+			i = nodes[i].parent;
+		}
+	}
+
+	// rotates the taller grandchild up if the children's heights differ by
+	// more than one. returns the node now in a's place.
+	int balance(int a)
+	{
+		Node& A = nodes[a];
+		if (A.item >= 0 || A.height < 2) return a;
+
+		int b = A.child[0], c = A.child[1];
+		int diff = nodes[c].height - nodes[b].height;
+
+		if (diff > 1) return rotate(a, 1);
+		if (diff < -1) return rotate(a, 0);
+		return a;
+	}
+
+	// lifts child `side` of a into a's place
+	int rotate(int a, int side)
+	{
+		int up = nodes[a].child[side];
+		int other = nodes[a].child[1 - side];
+
+		int f = nodes[up].child[0], g = nodes[up].child[1];
+
+		nodes[up].child[0] = a;
+		nodes[up].parent = nodes[a].parent;
+		nodes[a].parent = up;
+
+		if (nodes[up].parent >= 0) replaceChild(nodes[up].parent, a, up);
+		else root = up;
+
+		// the taller grandchild stays with `up`, the other moves down to a
+		int keep = f, give = g;
+		if (nodes[g].height > nodes[f].height) swap(keep, give);
+
+		nodes[up].child[1] = keep;
+		nodes[a].child[side] = give;
+		nodes[a].child[1 - side] = other;
+		nodes[give].parent = a;
+
+		fit(a);
+		fit(up);
+
+		return up;
+	}
+
+	bool slab(const Node& n, const ofVec3f& origin, const ofVec3f& inv_dir, float max_t, float& t) const
+	{
+		float t_near = 0, t_far = max_t;
+
+		for (int a = 0; a < 3; a++)
+		{
+			float t1 = (n.lo[a] - origin[a]) * inv_dir[a];
+			float t2 = (n.hi[a] - origin[a]) * inv_dir[a];
+			if (t1 > t2) swap(t1, t2);
+
+			// 0 * inf on a parallel axis is nan, which these comparisons ignore
+			if (t1 > t_near) t_near = t1;
+			if (t2 < t_far) t_far = t2;
+		}
+
+		t = t_near;
+		return t_near <= t_far;
+	}
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// .vxb layout, little endian:
+//
+//   VxbHeader
+//   VxbVoxel[num_voxels]  at voxels_offset
+//   metadata bytes        at metadata_offset
+//
+// voxel ids are implicit, the same as the record index (like save() does
+// for json). readers must reject files with a newer version or a record
+// size smaller than they expect, and skip trailing bytes of larger records.
+
+const char VXB_MAGIC[4] = { 'V', 'X', 'B', '\0' };
+const uint32_t VXB_VERSION = 1;
+
+#pragma pack(push, 1)
+
+struct VxbHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint64_t num_voxels;
+	uint64_t voxels_offset;
+	uint64_t metadata_offset;
+	uint64_t metadata_size;
+	int64_t updated_at;
+};
+
+struct VxbVoxel
+{
+	int32_t x, y, z;
+	int32_t w, h, d;
+	uint32_t color; // 0xRRGGBB, same as json
+};
+
+#pragma pack(pop)
+
+// read only view of a whole file, mmapped where available
+class VxbMappedFile
+{
+public:
+
+	VxbMappedFile() : ptr(NULL), length(0) {}
+	~VxbMappedFile() { close(); }
+
+	bool open(const string& path)
+	{
+		close();
+
+#ifdef _WIN32
+		std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+		if (!in) return false;
+
+		buffer.resize((size_t)in.tellg());
+		in.seekg(0);
+		if (!buffer.empty()) in.read(&buffer[0], buffer.size());
+
+		ptr = buffer.empty() ? NULL : &buffer[0];
+		length = buffer.size();
+		return (bool)in;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (p == MAP_FAILED) return false;
+
+		// records are read once front to back
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+		ptr = (const char*)p;
+		length = st.st_size;
+		return true;
+#endif
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		buffer.clear();
+#else
+		if (ptr) munmap((void*)ptr, length);
+#endif
+		ptr = NULL;
+		length = 0;
+	}
+
+	const char* data() const { return ptr; }
+	size_t size() const { return length; }
+
+private:
+
+	const char* ptr;
+	size_t length;
+
+#ifdef _WIN32
+	vector<char> buffer;
+#endif
+
+	VxbMappedFile(const VxbMappedFile&);
+	VxbMappedFile& operator=(const VxbMappedFile&);
+};
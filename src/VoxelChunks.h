@@ -0,0 +1,579 @@
+#pragma once
+
+#include "VoxelIndex.h"
+#include "VoxelBVH.h"
+
+// 16^3 block of unit voxels. every cell stores an index into a chunk local
+// colour palette, bit-packed at the smallest power of two width that fits.
+// palette entry 0 means empty.
+struct VoxelChunk
+{
+	enum { SHIFT = 4, SIZE = 1 << SHIFT, MASK = SIZE - 1, VOLUME = SIZE * SIZE * SIZE };
+
+	int cx, cy, cz;
+	int num_voxels;
+
+	VoxelChunk(int cx = 0, int cy = 0, int cz = 0)
+		: cx(cx), cy(cy), cz(cz), num_voxels(0), bits_per_cell(0)
+	{
+		palette.push_back(ofColor(0, 0));
+		refcount.push_back(0);
+	}
+
+	// x runs fastest so rows along x are contiguous in memory
+	static int cellIndex(int lx, int ly, int lz)
+	{
+		return (lz * SIZE + ly) * SIZE + lx;
+	}
+
+	bool get(int lx, int ly, int lz, ofColor& color) const
+	{
+		int p = getIndex(cellIndex(lx, ly, lz));
+		if (p == 0) return false;
+		color = palette[p];
+		return true;
+	}
+
+	bool has(int lx, int ly, int lz) const
+	{
+		return getIndex(cellIndex(lx, ly, lz)) != 0;
+	}
+
+	void set(int lx, int ly, int lz, const ofColor& color)
+	{
+		int cell = cellIndex(lx, ly, lz);
+		int p = paletteIndex(color);
+		int old = getIndex(cell);
+		if (old == p) return;
+
+		if (old == 0) num_voxels++;
+		else release(old);
+
+		refcount[p]++;
+		setIndex(cell, p);
+	}
+
+	void erase(int lx, int ly, int lz)
+	{
+		int cell = cellIndex(lx, ly, lz);
+		int old = getIndex(cell);
+		if (old == 0) return;
+
+		release(old);
+		num_voxels--;
+		setIndex(cell, 0);
+	}
+
+	// raw palette access, equal indices within a chunk mean equal colours
+	int getPaletteIndex(int lx, int ly, int lz) const
+	{
+		return getIndex(cellIndex(lx, ly, lz));
+	}
+
+	const ofColor& getPaletteColor(int p) const { return palette[p]; }
+
+	int getBitsPerCell() const { return bits_per_cell; }
+	size_t getPaletteSize() const { return palette.size() - 1; }
+
+	size_t memoryUsage() const
+	{
+		return sizeof(VoxelChunk)
+			+ palette.capacity() * sizeof(ofColor)
+			+ refcount.capacity() * sizeof(int)
+			+ lookup.capacity() * sizeof(lookup[0])
+			+ free_slots.capacity() * sizeof(int)
+			+ bits.capacity() * sizeof(uint64_t);
+	}
+
+	template <typename F>
+	void forEach(F f) const
+	{
+		if (num_voxels == 0) return;
+
+		int ox = cx << SHIFT, oy = cy << SHIFT, oz = cz << SHIFT;
+		int cell = 0;
+
+		for (int z = 0; z < SIZE; z++)
+			for (int y = 0; y < SIZE; y++)
+				for (int x = 0; x < SIZE; x++, cell++)
+				{
+					int p = getIndex(cell);
+					if (p != 0) f(ox + x, oy + y, oz + z, palette[p]);
+				}
+	}
+
+private:
+
+	vector<ofColor> palette;
+	vector<int> refcount;
+	vector<uint64_t> bits;
+	int bits_per_cell;
+
+	// (colour, palette index) sorted by colour, one per used entry, and
+	// the entries whose refcount dropped to zero. stale ones are skipped.
+	vector<std::pair<uint32_t, int> > lookup;
+	vector<int> free_slots;
+
+	static uint32_t colorKey(const ofColor& c)
+	{
+		return ((uint32_t)c.r << 24) | ((uint32_t)c.g << 16) | ((uint32_t)c.b << 8) | (uint32_t)c.a;
+	}
+
+	void release(int p)
+	{
+		if (--refcount[p] == 0) free_slots.push_back(p);
+	}
+
+	int getIndex(int cell) const
+	{
+		if (bits_per_cell == 0) return 0;
+
+		int bit = cell * bits_per_cell;
+		uint64_t mask = (1ULL << bits_per_cell) - 1;
+		return (bits[bit >> 6] >> (bit & 63)) & mask;
+	}
+
+	void setIndex(int cell, int p)
+	{
+		int bit = cell * bits_per_cell;
+		uint64_t mask = ((1ULL << bits_per_cell) - 1) << (bit & 63);
+		uint64_t& word = bits[bit >> 6];
+		word = (word & ~mask) | (((uint64_t)p << (bit & 63)) & mask);
+	}
+
+	// binary search for the colour, a free entry or a new one if it isn't
+	// there. an unused entry that still has the colour is taken as is.
+	int paletteIndex(const ofColor& color)
+	{
+		std::pair<uint32_t, int> k(colorKey(color), 0);
+
+		vector<std::pair<uint32_t, int> >::iterator it = std::lower_bound(lookup.begin(), lookup.end(), k);
+		if (it != lookup.end() && it->first == k.first) return it->second;
+
+		int p = 0;
+		while (p == 0 && !free_slots.empty())
+		{
+			if (refcount[free_slots.back()] == 0) p = free_slots.back();
+			free_slots.pop_back();
+		}
+
+		if (p != 0)
+		{
+			std::pair<uint32_t, int> old(colorKey(palette[p]), 0);
+			lookup.erase(std::lower_bound(lookup.begin(), lookup.end(), old));
+			palette[p] = color;
+		}
+		else
+		{
+			palette.push_back(color);
+			refcount.push_back(0);
+			p = palette.size() - 1;
+
+			if (bits_per_cell == 0 || p >= (1 << bits_per_cell))
+			{
+				int n = bits_per_cell == 0 ? 1 : bits_per_cell * 2;
+				while (p >= (1 << n)) n *= 2;
+				repack(n);
+			}
+		}
+
+		k.second = p;
+		lookup.insert(std::lower_bound(lookup.begin(), lookup.end(), k), k);
+		return p;
+	}
+
+	// widths are powers of two so a cell never straddles two words
+	void repack(int new_bits)
+	{
+		vector<uint64_t> old_bits(VOLUME * new_bits / 64, 0);
+		old_bits.swap(bits);
+
+		int old_bits_per_cell = bits_per_cell;
+		bits_per_cell = new_bits;
+
+		if (old_bits_per_cell == 0) return;
+
+		uint64_t mask = (1ULL << old_bits_per_cell) - 1;
+		for (int cell = 0; cell < VOLUME; cell++)
+		{
+			int bit = cell * old_bits_per_cell;
+			int p = (old_bits[bit >> 6] >> (bit & 63)) & mask;
+			if (p != 0) setIndex(cell, p);
+		}
+	}
+};
+
+// sparse set of VoxelChunks, addressed through a VoxelIndex on chunk
+// coordinates. stores unit voxels only. a chunk whose last voxel is erased
+// is freed.
+class VoxelChunkStore
+{
+public:
+
+	VoxelChunkStore() : num_voxels(0) {}
+
+	bool get(int x, int y, int z, ofColor& color) const
+	{
+		const VoxelChunk* c = findChunk(x >> VoxelChunk::SHIFT, y >> VoxelChunk::SHIFT, z >> VoxelChunk::SHIFT);
+		if (c == NULL) return false;
+		return c->get(x & VoxelChunk::MASK, y & VoxelChunk::MASK, z & VoxelChunk::MASK, color);
+	}
+
+	bool has(int x, int y, int z) const
+	{
+		const VoxelChunk* c = findChunk(x >> VoxelChunk::SHIFT, y >> VoxelChunk::SHIFT, z >> VoxelChunk::SHIFT);
+		if (c == NULL) return false;
+		return c->has(x & VoxelChunk::MASK, y & VoxelChunk::MASK, z & VoxelChunk::MASK);
+	}
+
+	void set(int x, int y, int z, const ofColor& color)
+	{
+		VoxelChunk& c = getChunk(x >> VoxelChunk::SHIFT, y >> VoxelChunk::SHIFT, z >> VoxelChunk::SHIFT);
+		num_voxels -= c.num_voxels;
+		c.set(x & VoxelChunk::MASK, y & VoxelChunk::MASK, z & VoxelChunk::MASK, color);
+		num_voxels += c.num_voxels;
+	}
+
+	void erase(int x, int y, int z)
+	{
+		int i = chunk_index.find(x >> VoxelChunk::SHIFT, y >> VoxelChunk::SHIFT, z >> VoxelChunk::SHIFT);
+		if (i < 0) return;
+
+		VoxelChunk& c = chunks[i];
+		num_voxels -= c.num_voxels;
+		c.erase(x & VoxelChunk::MASK, y & VoxelChunk::MASK, z & VoxelChunk::MASK);
+		num_voxels += c.num_voxels;
+
+		if (c.num_voxels == 0) removeChunk(i);
+	}
+
+	void clear()
+	{
+		chunks.clear();
+		chunk_index.clear();
+		num_voxels = 0;
+	}
+
+	size_t size() const { return num_voxels; }
+	bool empty() const { return num_voxels == 0; }
+
+	size_t memoryUsage() const
+	{
+		size_t n = sizeof(VoxelChunkStore);
+		for (int i = 0; i < chunks.size(); i++)
+			n += chunks[i].memoryUsage();
+		return n;
+	}
+
+	const VoxelChunk* findChunk(int cx, int cy, int cz) const
+	{
+		int i = chunk_index.find(cx, cy, cz);
+		if (i < 0) return NULL;
+		return &chunks[i];
+	}
+
+	const vector<VoxelChunk>& getChunks() const { return chunks; }
+
+	// f(x, y, z, color) for every voxel, chunk by chunk
+	template <typename F>
+	void forEach(F f) const
+	{
+		for (int i = 0; i < chunks.size(); i++)
+			chunks[i].forEach(f);
+	}
+
+	// f(x, y, z, color) for every voxel in [x0, x1) x [y0, y1) x [z0, z1).
+	// looks up the chunks the region covers, or tests every chunk when
+	// there are fewer of those.
+	template <typename F>
+	void forEachIn(int x0, int y0, int z0, int x1, int y1, int z1, F f) const
+	{
+		if (x0 >= x1 || y0 >= y1 || z0 >= z1 || chunks.empty()) return;
+
+		int lo[3] = { x0, y0, z0 };
+		int hi[3] = { x1, y1, z1 };
+		int c0[3], c1[3];
+		long long span = 1;
+
+		for (int a = 0; a < 3; a++)
+		{
+			c0[a] = lo[a] >> VoxelChunk::SHIFT;
+			c1[a] = (hi[a] - 1) >> VoxelChunk::SHIFT;
+			span *= c1[a] - c0[a] + 1;
+		}
+
+		if (span <= (long long)chunks.size())
+		{
+			for (int cz = c0[2]; cz <= c1[2]; cz++)
+				for (int cy = c0[1]; cy <= c1[1]; cy++)
+					for (int cx = c0[0]; cx <= c1[0]; cx++)
+					{
+						const VoxelChunk* c = findChunk(cx, cy, cz);
+						if (c) forEachInChunk(*c, lo, hi, f);
+					}
+		}
+		else
+		{
+			for (int i = 0; i < chunks.size(); i++)
+			{
+				const VoxelChunk& c = chunks[i];
+				if (c.cx >= c0[0] && c.cx <= c1[0]
+					&& c.cy >= c0[1] && c.cy <= c1[1]
+					&& c.cz >= c0[2] && c.cz <= c1[2])
+					forEachInChunk(c, lo, hi, f);
+			}
+		}
+	}
+
+	// this store becomes one cell per 2^shift cube of fine, coloured with
+	// the average of the voxels inside it
+	void downsample(const VoxelChunkStore& fine, int shift)
+	{
+		clear();
+
+		vector<ColorSum> sums;
+		VoxelIndex sum_index;
+
+		fine.forEach([&](int x, int y, int z, const ofColor& color)
+		{
+			addSum(sums, sum_index, x >> shift, y >> shift, z >> shift, color);
+		});
+
+		setSums(sums);
+	}
+
+	// downsample() again for the coarse cells in [x0, x1) x [y0, y1) x
+	// [z0, z1) only, after fine changed there
+	void resample(const VoxelChunkStore& fine, int shift, int x0, int y0, int z0, int x1, int y1, int z1)
+	{
+		for (int z = z0; z < z1; z++)
+			for (int y = y0; y < y1; y++)
+				for (int x = x0; x < x1; x++)
+					erase(x, y, z);
+
+		vector<ColorSum> sums;
+		VoxelIndex sum_index;
+
+		fine.forEachIn(x0 << shift, y0 << shift, z0 << shift, x1 << shift, y1 << shift, z1 << shift,
+					   [&](int x, int y, int z, const ofColor& color)
+		{
+			addSum(sums, sum_index, x >> shift, y >> shift, z >> shift, color);
+		});
+
+		setSums(sums);
+	}
+
+	// loose bounds in cells, whole chunks. false if there are no voxels
+	bool getBounds(int lo[3], int hi[3]) const
+	{
+		bool found = false;
+
+		for (int i = 0; i < chunks.size(); i++)
+		{
+			const VoxelChunk& c = chunks[i];
+			if (c.num_voxels == 0) continue;
+
+			int o[3] = { c.cx, c.cy, c.cz };
+			for (int a = 0; a < 3; a++)
+			{
+				int l = o[a] << VoxelChunk::SHIFT;
+				int h = l + VoxelChunk::SIZE;
+				lo[a] = found ? std::min(lo[a], l) : l;
+				hi[a] = found ? std::max(hi[a], h) : h;
+			}
+
+			found = true;
+		}
+
+		return found;
+	}
+
+	// nearest voxel along the ray closer than max_t. steps from chunk to
+	// chunk and only walks the cells of chunks that exist.
+	bool raycast(const ofVec3f& origin, const ofVec3f& dir, float max_t,
+				 int cell[3], float& t, ofVec3f& normal) const
+	{
+		int lo[3], hi[3];
+		if (!getBounds(lo, hi)) return false;
+
+		bool found = false;
+
+		walk(origin, dir, lo, hi, VoxelChunk::SIZE, max_t, [&](const int c[3], float, const ofVec3f&)
+		{
+			const VoxelChunk* chunk = findChunk(c[0], c[1], c[2]);
+			if (chunk == NULL || chunk->num_voxels == 0) return true;
+
+			int clo[3], chi[3];
+			for (int a = 0; a < 3; a++)
+			{
+				clo[a] = c[a] << VoxelChunk::SHIFT;
+				chi[a] = clo[a] + VoxelChunk::SIZE;
+			}
+
+			walk(origin, dir, clo, chi, 1, max_t, [&](const int p[3], float pt, const ofVec3f& pn)
+			{
+				if (!chunk->has(p[0] & VoxelChunk::MASK, p[1] & VoxelChunk::MASK, p[2] & VoxelChunk::MASK))
+					return true;
+
+				for (int a = 0; a < 3; a++) cell[a] = p[a];
+				t = pt;
+				normal = pn;
+				found = true;
+				return false;
+			});
+
+			return !found;
+		});
+
+		return found;
+	}
+
+private:
+
+	vector<VoxelChunk> chunks;
+	VoxelIndex chunk_index;
+	size_t num_voxels;
+
+	struct ColorSum
+	{
+		int x, y, z;
+		unsigned int r, g, b, a, n;
+	};
+
+	static void addSum(vector<ColorSum>& sums, VoxelIndex& sum_index, int x, int y, int z, const ofColor& color)
+	{
+		int i = sum_index.find(x, y, z);
+		if (i < 0)
+		{
+			i = sums.size();
+			sum_index.set(x, y, z, i);
+			ColorSum s = { x, y, z, 0, 0, 0, 0, 0 };
+			sums.push_back(s);
+		}
+
+		ColorSum& s = sums[i];
+		s.r += color.r;
+		s.g += color.g;
+		s.b += color.b;
+		s.a += color.a;
+		s.n++;
+	}
+
+	void setSums(const vector<ColorSum>& sums)
+	{
+		for (int i = 0; i < sums.size(); i++)
+		{
+			const ColorSum& s = sums[i];
+			set(s.x, s.y, s.z, ofColor(s.r / s.n, s.g / s.n, s.b / s.n, s.a / s.n));
+		}
+	}
+
+	template <typename F>
+	static void forEachInChunk(const VoxelChunk& c, const int lo[3], const int hi[3], F f)
+	{
+		int o[3] = { c.cx << VoxelChunk::SHIFT, c.cy << VoxelChunk::SHIFT, c.cz << VoxelChunk::SHIFT };
+		int l[3], h[3];
+		for (int a = 0; a < 3; a++)
+		{
+			l[a] = std::max(lo[a] - o[a], 0);
+			h[a] = std::min(hi[a] - o[a], (int)VoxelChunk::SIZE);
+		}
+
+		ofColor color;
+		for (int z = l[2]; z < h[2]; z++)
+			for (int y = l[1]; y < h[1]; y++)
+				for (int x = l[0]; x < h[0]; x++)
+				{
+					if (c.get(x, y, z, color)) f(o[0] + x, o[1] + y, o[2] + z, color);
+				}
+	}
+
+	// cells of the given size along the ray inside [lo, hi), front to back
+	// (amanatides & woo). f(cell, t, normal) in units of size returns false
+	// to stop. lo and hi are multiples of size.
+	template <typename F>
+	static void walk(const ofVec3f& origin, const ofVec3f& dir, const int lo[3], const int hi[3],
+					 int size, float max_t, F f)
+	{
+		float t;
+		ofVec3f normal;
+		if (!VoxelBVH::intersectBox(origin, dir, ofVec3f(lo[0], lo[1], lo[2]), ofVec3f(hi[0], hi[1], hi[2]),
+									t, normal)) return;
+
+		ofVec3f p = origin + dir * t;
+
+		int cell[3], step[3], first[3], last[3];
+		float t_max[3], t_delta[3];
+
+		for (int a = 0; a < 3; a++)
+		{
+			first[a] = lo[a] / size;
+			last[a] = hi[a] / size - 1;
+
+			// the entry point lies on a face of the box, keep it inside
+			cell[a] = ofClamp(floor(p[a] / size), first[a], last[a]);
+
+			if (dir[a] > 0)
+			{
+				step[a] = 1;
+				t_max[a] = t + ((cell[a] + 1) * size - p[a]) / dir[a];
+				t_delta[a] = size / dir[a];
+			}
+			else if (dir[a] < 0)
+			{
+				step[a] = -1;
+				t_max[a] = t + (cell[a] * size - p[a]) / dir[a];
+				t_delta[a] = -size / dir[a];
+			}
+			else
+			{
+				step[a] = 0;
+				t_max[a] = FLT_MAX;
+				t_delta[a] = FLT_MAX;
+			}
+		}
+
+		while (t < max_t)
+		{
+			if (!f(cell, t, normal)) return;
+
+			int a = 0;
+			if (t_max[1] < t_max[a]) a = 1;
+			if (t_max[2] < t_max[a]) a = 2;
+
+			cell[a] += step[a];
+			if (cell[a] < first[a] || cell[a] > last[a]) return;
+
+			t = t_max[a];
+			t_max[a] += t_delta[a];
+
+			normal.set(0, 0, 0);
+			normal[a] = -step[a];
+		}
+	}
+
+	VoxelChunk& getChunk(int cx, int cy, int cz)
+	{
+		int i = chunk_index.find(cx, cy, cz);
+		if (i >= 0) return chunks[i];
+
+		chunk_index.set(cx, cy, cz, chunks.size());
+		chunks.push_back(VoxelChunk(cx, cy, cz));
+		return chunks.back();
+	}
+
+	// swap with the last chunk and pop
+	void removeChunk(int i)
+	{
+		int last = chunks.size() - 1;
+		chunk_index.erase(chunks[i].cx, chunks[i].cy, chunks[i].cz);
+
+		if (i != last)
+		{
+			std::swap(chunks[i], chunks[last]);
+			chunk_index.set(chunks[i].cx, chunks[i].cy, chunks[i].cz, i);
+		}
+
+		chunks.pop_back();
+	}
+};
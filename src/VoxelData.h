@@ -1,10 +1,13 @@
 #pragma once
 
-#include "ofxJsonxx.h"
-#include "ofxAssimpModelLoader.h"
-#include "triboxoverlap.h"
-#include <map>
+#include "VoxelIndex.h"
+#include "VoxelBVH.h"
+#include "VoxelChunks.h"
+#include "VoxelBinary.h"
+#include "VoxelJson.h"
+#include "VoxelImport.h"
 #include <algorithm>
+#include <functional>
 
 struct VoxelData
 {
@@ -28,6 +31,13 @@ struct VoxelData
 	}
 };
 
+// half open box of cells [x0, x1) x [y0, y1) x [z0, z1)
+struct VoxelRegion
+{
+	int x0, y0, z0;
+	int x1, y1, z1;
+};
+
 struct VoxelCoord {
     VoxelCoord(int nx, int ny, int nz) : x(nx), y(ny), z(nz) {};
     int x;
@@ -62,259 +72,468 @@ class Voxel
 {
 public:
 	
-	bool load(const string& path)
+	Voxel() : updatedAt(0), revision(0), dirty_all(true), overlapping(false) {}
+	
+	// the loads and saves take an optional progress callback, called every
+	// PROGRESS_INTERVAL voxels on the calling thread. see VoxelProgress.
+	enum { PROGRESS_INTERVAL = 1 << 14 };
+	
+	bool load(const string& path, VoxelProgress on_progress = VoxelProgress())
 	{
-		using namespace ofxJsonxx;
-		
-		Object json;
-		if (loadFromFile(json, path) == false) return false;
-		
-		// check version string
-		assert(get(json, "version", -1) == 1);
-		get(json, "updatedAt", updatedAt);
-		get(json, "metadata", metadata);
-
-		Array voxels;
-		assert(get(json, "voxels", voxels));
+		VoxelJsonReader reader;
+		if (reader.open(ofToDataPath(path)) == false) return false;
 		
 		this->voxels.clear();
+		this->chunks.clear();
+		this->voxel_ids.clear();
 		
-		for (int i = 0; i < voxels.size(); i++)
+		bool supported = true;
+		bool cancelled = false;
+		size_t count = 0, dropped = 0;
+		
+		bool ok = reader.read([&](const VoxelJsonReader::Header& header)
+		{
+			// check version string
+			if (header.version != 1 && header.version != 2)
+			{
+				ofLogError("VoxelData") << "load(): unsupported version: " << header.version;
+				supported = false;
+				return false;
+			}
+			
+			return true;
+		},
+		[&](const VoxelJsonReader::Record& r)
 		{
-			const Object& voxel = voxels.get<Object>(i);
 			VoxelData v;
+			v.id = r.id;
+			v.x = r.x;
+			v.y = r.y;
+			v.z = r.z;
+			v.w = r.w;
+			v.h = r.h;
+			v.d = r.d;
 			
-			get(voxel, "id", v.id);
-			get(voxel, "x", v.x);
-			get(voxel, "y", v.y);
-			get(voxel, "z", v.z);
-			get(voxel, "w", v.w);
-			get(voxel, "h", v.h);
-			get(voxel, "d", v.d);
+			if (r.has_color)
+				v.color = ofColor::fromHex(r.color);
 			
-			voxel_ids.insert(v.id);
+			if (!inRange(v))
+			{
+				dropped++;
+				return;
+			}
 			
-			int c;
-			if (get(voxel, "color", c)) {
-				v.color = ofColor::fromHex(c);
+			if (isUnit(v))
+			{
+				this->chunks.set(v.x, v.y, v.z, v.color);
+			}
+			else
+			{
+				// ids come in ascending order from version 2 files and usually from 1
+				voxel_ids.insert(voxel_ids.end(), v.id);
+				this->voxels.push_back(v);
 			}
 			
-			this->voxels.push_back(v);
+			if (on_progress && ++count % PROGRESS_INTERVAL == 0
+				&& !on_progress(reader.getPosition() / (float)std::max<size_t>(reader.getSize(), 1)))
+			{
+				cancelled = true;
+				reader.stop();
+			}
+		});
+		
+		if (ok)
+		{
+			updatedAt = reader.getHeader().updated_at;
+			metadata = reader.getHeader().metadata;
+			logDropped("load()", dropped);
+		}
+		else
+		{
+			if (cancelled) ofLogNotice("VoxelData") << "load(): cancelled: " << path;
+			else if (supported) ofLogError("VoxelData") << "load(): parse error: " << path;
+			this->voxels.clear();
+			this->chunks.clear();
+			this->voxel_ids.clear();
 		}
 		
-		return true;
+		rebuildIndex();
+		
+		return ok;
 	}
     
-    bool intersect(ofVec3f face[3], float x, float y, float z, float length) {
-        double box_center[3] = {x + length / 2, y + length / 2, z + length / 2};
-        double box_half_size[3] = {length / 2, length / 2, length / 2};
-        double triangle[3][3] = {{face[0].x, face[0].y, face[0].z}, {face[1].x, face[1].y, face[1].z}, {face[2].x, face[2].y, face[2].z}};
-        return triBoxOverlap(box_center, box_half_size, triangle);
-    }
-    
-    bool loadObj(const string& path)
-    {
-        ofxAssimpModelLoader model;
-
-        // FIXME: workaround for assimp parsing bug.
-        // assimp parseFile() has a bug that will crash if the last line of *.obj file is not a newline.
-        // This hack copies the original *.obj file and then append a newline to it.
-        string patched_path = path + ".patched.obj";
-        ofFile::copyFromTo(path, patched_path);
-        ofFile patched_file = ofFile(patched_path, ofFile::Append);
-        patched_file << "\n";
-        patched_file.close();
-        
-        // Load the patched file
-        bool loaded = model.loadModel(patched_path);
-        ofFile::removeFile(patched_path);
-        
-        if (loaded == false) return false;
-        
-        this->voxels.clear();
-        map<VoxelCoord, ofColor> colors;
-        
-        for (int mesh_idx = 0; mesh_idx < model.getNumMeshes(); mesh_idx++) {
-            ofMesh mesh = model.getMesh(mesh_idx);
-            
-            // Only support TRIANGLES
-            if (mesh.getMode() != OF_PRIMITIVE_TRIANGLES) {
-                ofLogError("VoxelData") << "loadObj(): not supported mesh mode: " << mesh.getMode();
-                continue;
-            }
-            
-            vector<ofVec3f> vertices = mesh.getVertices();
-            
-            // Calculate bounds
-            float min_x = std::min_element(vertices.begin(), vertices.end(), compare_x)->x;
-            float max_x = std::max_element(vertices.begin(), vertices.end(), compare_x)->x;
-            float min_y = std::min_element(vertices.begin(), vertices.end(), compare_y)->y;
-            float max_y = std::max_element(vertices.begin(), vertices.end(), compare_y)->y;
-            float min_z = std::min_element(vertices.begin(), vertices.end(), compare_z)->z;
-            float max_z = std::max_element(vertices.begin(), vertices.end(), compare_z)->z;
-
-            // Calculate w, d, h
-            float w = max_x - min_x;
-            float d = max_z - min_z;
-            float h = max_y - min_y;
-            
-            // Calculate step
-            float step = (w * 60 < d * 80) ? d / 60 : w / 80;
-            
-            // Read texture
-            ofTexture texture = model.getTextureForMesh(mesh_idx);
-            ofPixels pixels;
-            texture.readToPixels(pixels);
-            
-            // Iterate through all faces
-            for (int idx = 0; idx < mesh.getNumIndices(); idx += 3) {
-                ofVec3f face_vertices[3] = {vertices[mesh.getIndex(idx)], vertices[mesh.getIndex(idx + 1)], vertices[mesh.getIndex(idx + 2)]};
-                std::vector<ofVec3f> face(&face_vertices[0], &face_vertices[0] + 3);
-                
-                // Calculate the bounding box of face
-                float local_min_x = std::min_element(face.begin(), face.end(), compare_x)->x;
-                float local_max_x = std::max_element(face.begin(), face.end(), compare_x)->x;
-                float local_min_y = std::min_element(face.begin(), face.end(), compare_y)->y;
-                float local_max_y = std::max_element(face.begin(), face.end(), compare_y)->y;
-                float local_min_z = std::min_element(face.begin(), face.end(), compare_z)->z;
-                float local_max_z = std::max_element(face.begin(), face.end(), compare_z)->z;
-                
-                // Calculate the voxel coordination
-                int x_start = floor((local_min_x - min_x) / step);
-                int x_end = ceil((local_max_x - min_x) / step);
-                int y_start = floor((local_min_y - min_y) / step);
-                int y_end = ceil((local_max_y - min_y) / step);
-                int z_start = floor((local_min_z - min_z) / step);
-                int z_end = ceil((local_max_z - min_z) / step);
-                
-                // Check all the voxels in the bounding box intersecting the face
-                for (int x = x_start; x < x_end; x++)
-                    for (int y = y_start; y < y_end; y++)
-                        for (int z = z_start; z < z_end; z++) {
-                            if (intersect(face_vertices, min_x + x * step, min_y + y * step, min_z + z * step, step) == false) continue;
-                            
-                            // Get the color of voxel (x, y, z). Currently it just pick color from one vertex.
-                            // TODO: interpolate the color.
-                            
-                            ofColor color;
-                            
-                            if (mesh.hasColors() && mesh.getIndex(idx) < mesh.getNumColors()) {
-                                color = mesh.getColor(mesh.getIndex(idx));
-                            }
-                            if (mesh.getIndex(idx) < mesh.getNumTexCoords()) {
-                                ofVec2f texCoord = mesh.getTexCoord(mesh.getIndex(idx));
-                                color = pixels.getColor(texCoord.x * pixels.getWidth(), texCoord.y * pixels.getHeight());
-                            }
-                            colors[VoxelCoord(x, y, z)] = color;
-                        }
-            }
-        }
-        
-        // Add the voxels
-        int id = 0;
-        for (auto record : colors) {
-            VoxelData v;
-            v.x = record.first.x;
-            v.y = record.first.y;
-            v.z = record.first.z;
-            v.color = record.second;
-            v.w = v.d = v.h = 1;
-            v.id = id++;
-            this->voxels.push_back(v);
-            this->voxel_ids.insert(v.id);
-        }
-        
-        return true;
-    }
+	// on_progress, if given, is called on the calling thread with the
+	// fraction of faces done so far
+	bool loadObj(const string& path, const VoxelImportOptions& options = VoxelImportOptions(),
+				 VoxelProgress on_progress = VoxelProgress())
+	{
+		VoxelObjImporter importer;
+		if (importer.open(path) == false) return false;
+		
+		return loadObj(importer, options, on_progress);
+	}
 	
-	bool save(const string& path)
+	// replace the model with another voxelization of an opened obj file
+	bool loadObj(const VoxelObjImporter& importer, const VoxelImportOptions& options,
+				 VoxelProgress on_progress = VoxelProgress())
 	{
-		using namespace ofxJsonxx;
+		VoxelImportGrid grid;
+		VoxelImportStats stats;
+		if (importer.voxelize(options, grid, stats, on_progress) == false) return false;
+		
+		import_stats = stats;
+		ofLogNotice("VoxelData") << "loadObj(): " << stats.faces << " faces, tested " << stats.cells_tested
+			<< " cells for " << stats.hits << " hits (" << stats.getTestedPerHit() << " per hit)";
 		
-		Object json;
-		ofxJsonxx::set(json, "version", 1);
-		ofxJsonxx::set(json, "updatedAt", time(0));
-		ofxJsonxx::set(json, "metadata", metadata);
+		if (options.solid)
+		{
+			ofLogNotice("VoxelData") << "loadObj(): filled " << stats.filled << " inside cells"
+				<< (stats.flooded ? " from outside, the model is not closed" : "");
+		}
 		
-		Array voxels;
+		this->voxels.clear();
+		this->voxel_ids.clear();
+		this->chunks.clear();
 		
-		for (int i = 0; i < this->voxels.size(); i++)
+		// full resolution imports are unit cubes only and go to the chunks,
+		// coarse cells are boxes
+		int f = std::max(options.coarse_factor, 1);
+		size_t dropped = 0;
+		
+		grid.forEach([&](int x, int y, int z, const ofColor& color)
 		{
-			const VoxelData& v = this->voxels[i];
-			Object voxel;
+			if (!VoxelIndex::contains((long long)x * f, (long long)y * f, (long long)z * f, f, f, f))
+			{
+				dropped++;
+				return;
+			}
 			
-			ofxJsonxx::set(voxel, "id", i);
-			ofxJsonxx::set(voxel, "x", v.x);
-			ofxJsonxx::set(voxel, "y", v.y);
-			ofxJsonxx::set(voxel, "z", v.z);
-			ofxJsonxx::set(voxel, "w", v.w);
-			ofxJsonxx::set(voxel, "h", v.h);
-			ofxJsonxx::set(voxel, "d", v.d);
-			ofxJsonxx::set(voxel, "color", v.color.getHex());
+			if (f == 1)
+			{
+				this->chunks.set(x, y, z, color);
+				return;
+			}
 			
-			voxels << voxel;
-		}
+			VoxelData v;
+			v.id = voxels.size();
+			v.x = x * f;
+			v.y = y * f;
+			v.z = z * f;
+			v.w = v.h = v.d = f;
+			v.color = color;
+			
+			this->voxels.push_back(v);
+			voxel_ids.insert(voxel_ids.end(), v.id);
+		});
+		
+		logDropped("loadObj()", dropped);
+		rebuildIndex();
+		
+		return true;
+	}
+	
+	// version 1 is one object per voxel and what older readers know, 2
+	// packs runs and a palette per block and is opt-in. see VoxelJson.h
+	bool save(const string& path, int version = 1, VoxelProgress on_progress = VoxelProgress())
+	{
+		VoxelJsonWriter writer;
+		if (writer.open(ofToDataPath(path)) == false) return false;
+		
+		writer.begin(version, time(0), metadata);
+		writer.beginVoxels();
+		
+		int i = 0;
+		bool cancelled = false;
+		size_t total = size();
 		
-		json << "voxels" << voxels;
+		forEach([&](const VoxelData& v)
+		{
+			if (cancelled) return;
+			writer.voxel(i++, v.x, v.y, v.z, v.w, v.h, v.d, v.color.getHex());
+			
+			if (on_progress && i % PROGRESS_INTERVAL == 0 && !on_progress(i / (float)total))
+				cancelled = true;
+		});
+		
+		writer.endVoxels();
 		
-		return saveToFile(json, path);
+		return writer.close() && !cancelled;
 	}
 	
-	bool exists(const ofVec3f& pos)
+	bool loadBinary(const string& path, VoxelProgress on_progress = VoxelProgress())
 	{
-		vector<VoxelData>::iterator it = voxels.begin();
-		while (it != voxels.end())
+		VxbMappedFile file;
+		if (file.open(ofToDataPath(path)) == false) return false;
+		
+		const char* data = file.data();
+		size_t size = file.size();
+		
+		if (size < sizeof(VxbHeader)) return false;
+		
+		VxbHeader header;
+		memcpy(&header, data, sizeof(header));
+		
+		if (memcmp(header.magic, VXB_MAGIC, 4) != 0
+			|| header.version > VXB_VERSION
+			|| header.record_size < sizeof(VxbVoxel))
+		{
+			ofLogError("VoxelData") << "loadBinary(): unsupported file: " << path;
+			return false;
+		}
+		
+		if (header.voxels_offset > size
+			|| header.num_voxels > (size - header.voxels_offset) / header.record_size
+			|| header.metadata_offset > size
+			|| header.metadata_size > size - header.metadata_offset)
 		{
-			const VoxelData& voxel = *it;
-			if (voxel.x == pos.x
-				&& voxel.y == pos.y
-				&& voxel.z == pos.z)
+			ofLogError("VoxelData") << "loadBinary(): truncated file: " << path;
+			return false;
+		}
+		
+		updatedAt = header.updated_at;
+		metadata.assign(data + header.metadata_offset, header.metadata_size);
+		
+		this->voxels.clear();
+		this->chunks.clear();
+		this->voxel_ids.clear();
+		
+		const char* record = data + header.voxels_offset;
+		size_t dropped = 0;
+		
+		for (size_t i = 0; i < header.num_voxels; i++, record += header.record_size)
+		{
+			if (on_progress && i % PROGRESS_INTERVAL == 0 && !on_progress(i / (float)header.num_voxels))
 			{
-				return true;
+				this->voxels.clear();
+				this->chunks.clear();
+				this->voxel_ids.clear();
+				rebuildIndex();
+				return false;
 			}
 			
-			it++;
+			VxbVoxel r;
+			memcpy(&r, record, sizeof(r));
+			
+			VoxelData v;
+			v.id = voxels.size();
+			v.x = r.x;
+			v.y = r.y;
+			v.z = r.z;
+			v.w = r.w;
+			v.h = r.h;
+			v.d = r.d;
+			v.color = ofColor::fromHex(r.color);
+			
+			if (!inRange(v))
+			{
+				dropped++;
+				continue;
+			}
+			
+			if (isUnit(v))
+			{
+				this->chunks.set(v.x, v.y, v.z, v.color);
+				continue;
+			}
+			
+			voxel_ids.insert(voxel_ids.end(), v.id);
+			this->voxels.push_back(v);
 		}
 		
-		return false;
+		logDropped("loadBinary()", dropped);
+		rebuildIndex();
+		
+		return true;
 	}
 	
-	void remove(const ofVec3f& pos)
+	bool saveBinary(const string& path, VoxelProgress on_progress = VoxelProgress())
 	{
-		vector<VoxelData>::iterator it = voxels.begin();
-		while (it != voxels.end())
+		FILE* fp = fopen(ofToDataPath(path).c_str(), "wb");
+		if (fp == NULL) return false;
+		
+		VxbHeader header;
+		memcpy(header.magic, VXB_MAGIC, 4);
+		header.version = VXB_VERSION;
+		header.header_size = sizeof(VxbHeader);
+		header.record_size = sizeof(VxbVoxel);
+		header.num_voxels = size();
+		header.voxels_offset = sizeof(VxbHeader);
+		header.metadata_offset = header.voxels_offset + header.num_voxels * sizeof(VxbVoxel);
+		header.metadata_size = metadata.size();
+		header.updated_at = time(0);
+		
+		bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+		
+		// write records in blocks to keep the stdio calls down
+		vector<VxbVoxel> block;
+		block.reserve(4096);
+		size_t written = 0;
+		
+		forEach([&](const VoxelData& v)
 		{
-			const VoxelData& voxel = *it;
-			if (voxel.x == pos.x
-				&& voxel.y == pos.y
-				&& voxel.z == pos.z)
+			if (!ok) return;
+			
+			VxbVoxel r;
+			r.x = v.x;
+			r.y = v.y;
+			r.z = v.z;
+			r.w = v.w;
+			r.h = v.h;
+			r.d = v.d;
+			r.color = v.color.getHex();
+			block.push_back(r);
+			
+			if (block.size() == block.capacity())
 			{
-				voxel_ids.erase(it->id);
-				it = voxels.erase(it);
-			} else it++;
+				ok = ok && fwrite(&block[0], sizeof(VxbVoxel), block.size(), fp) == block.size();
+				written += block.size();
+				block.clear();
+				
+				if (on_progress && written % PROGRESS_INTERVAL == 0
+					&& !on_progress(written / (float)header.num_voxels)) ok = false;
+			}
+		});
+		
+		if (!block.empty())
+			ok = ok && fwrite(&block[0], sizeof(VxbVoxel), block.size(), fp) == block.size();
+		
+		if (!metadata.empty())
+			ok = ok && fwrite(metadata.data(), 1, metadata.size(), fp) == metadata.size();
+		
+		ok = (fclose(fp) == 0) && ok;
+		
+		return ok;
+	}
+	
+	// pick the format from the file extension, json unless it is .vxb
+	bool loadFile(const string& path, VoxelProgress on_progress = VoxelProgress())
+	{
+		if (isBinaryPath(path)) return loadBinary(path, on_progress);
+		return load(path, on_progress);
+	}
+	
+	bool saveFile(const string& path, VoxelProgress on_progress = VoxelProgress(), int json_version = 1)
+	{
+		if (isBinaryPath(path)) return saveBinary(path, on_progress);
+		return save(path, json_version, on_progress);
+	}
+	
+	// exchange models, e.g. with one loaded on another thread. caches built
+	// from either one see a new revision.
+	void swap(Voxel& o)
+	{
+		std::swap(updatedAt, o.updatedAt);
+		metadata.swap(o.metadata);
+		std::swap(import_stats, o.import_stats);
+		std::swap(overlapping, o.overlapping);
+		voxel_ids.swap(o.voxel_ids);
+		voxels.swap(o.voxels);
+		std::swap(chunks, o.chunks);
+		std::swap(index, o.index);
+		std::swap(bvh, o.bvh);
+		
+		revision = o.revision = std::max(revision, o.revision) + 1;
+		markAllDirty();
+		o.markAllDirty();
+	}
+	
+	// e.g. convert("model.json", "model.vxb") and back
+	static bool convert(const string& src_path, const string& dst_path)
+	{
+		Voxel voxel;
+		if (voxel.loadFile(src_path) == false) return false;
+		return voxel.saveFile(dst_path);
+	}
+	
+	static bool isBinaryPath(const string& path)
+	{
+		return ofToLower(ofFilePath::getFileExt(path)) == "vxb";
+	}
+	
+	// unit voxels live in the chunks, a few bits each, and have no id:
+	// lookups hand them out as copies with id -1. boxes larger than one
+	// cell are kept in a list, with ids. voxels to remove or update are
+	// matched by origin, and boxes by id as well.
+	
+	bool exists(const ofVec3f& pos) const
+	{
+		return findOrigin(pos.x, pos.y, pos.z) >= 0 || chunks.has(pos.x, pos.y, pos.z);
+	}
+	
+	// copies the voxel whose origin is the cell, false if there is none
+	bool at(int x, int y, int z, VoxelData& v) const
+	{
+		int i = findOrigin(x, y, z);
+		if (i >= 0)
+		{
+			v = voxels[i];
+			return true;
 		}
+		
+		ofColor color;
+		if (!chunks.get(x, y, z, color)) return false;
+		
+		v = unitVoxel(x, y, z, color);
+		return true;
 	}
 	
-	void remove(VoxelData& voxel)
+	// copies the voxel covering the cell, false if there is none. like in
+	// the index, the voxel whose origin is the cell wins where they overlap.
+	bool find(int x, int y, int z, VoxelData& v) const
 	{
-		int id = voxel.id;
+		if (at(x, y, z, v)) return true;
 		
-		vector<VoxelData>::iterator it = voxels.begin();
-		while (it != voxels.end())
+		int i = index.find(x, y, z);
+		if (i < 0) return false;
+		
+		v = voxels[i];
+		return true;
+	}
+	
+	void remove(const ofVec3f& pos)
+	{
+		int i = findOrigin(pos.x, pos.y, pos.z);
+		if (i >= 0) removeAt(i);
+		else eraseUnit(pos.x, pos.y, pos.z);
+	}
+	
+	void remove(const VoxelData& voxel)
+	{
+		if (isUnit(voxel) && chunks.has(voxel.x, voxel.y, voxel.z))
 		{
-			VoxelData &v = *it;
-			if (v.id == id)
-			{
-				voxel_ids.erase(v.id);
-				it = voxels.erase(it);
-			}
-			else it++;
+			eraseUnit(voxel.x, voxel.y, voxel.z);
+			return;
 		}
+		
+		int i = indexOf(voxel);
+		if (i >= 0) removeAt(i);
 	}
 	
-	void add(const VoxelData& v)
+	// replaces the voxel with the same origin. stored, if given, gets the
+	// voxel as the model keeps it.
+	bool add(const VoxelData& v, VoxelData* stored = NULL)
 	{
+		if (!inRange(v))
+		{
+			ofLogError("VoxelData") << "add(): out of range: " << v.x << ", " << v.y << ", " << v.z;
+			return false;
+		}
+		
+		if (v.w < 1 || v.h < 1 || v.d < 1)
+		{
+			ofLogError("VoxelData") << "add(): size must be at least 1: " << v.w << " x " << v.h << " x " << v.d;
+			return false;
+		}
+		
 		remove(ofVec3f(v.x, v.y, v.z));
+		
+		if (isUnit(v))
+		{
+			setUnit(v.x, v.y, v.z, v.color);
+			if (stored) *stored = unitVoxel(v.x, v.y, v.z, v.color);
+			return true;
+		}
+		
 		voxels.push_back(v);
 		
 		if (voxel_ids.empty() == false)
@@ -324,19 +543,512 @@ public:
 		}
 		
 		voxel_ids.insert(voxels.back().id);
+		
+		indexVoxel(voxels.size() - 1);
+		markDirty(voxels.back());
+		revision++;
+		
+		if (stored) *stored = voxels.back();
+		return true;
+	}
+	
+	// put a voxel back exactly as it was, id included (undo / redo)
+	void restore(const VoxelData& v)
+	{
+		if (!inRange(v))
+		{
+			ofLogError("VoxelData") << "restore(): out of range: " << v.x << ", " << v.y << ", " << v.z;
+			return;
+		}
+		
+		if (isUnit(v))
+		{
+			setUnit(v.x, v.y, v.z, v.color);
+			return;
+		}
+		
+		voxels.push_back(v);
+		voxel_ids.insert(v.id);
+		
+		indexVoxel(voxels.size() - 1);
+		markDirty(v);
+		revision++;
+	}
+	
+	// move, resize or recolour a voxel, keeping the index in sync. a unit
+	// voxel grown into a box gets an id, a box shrunk to one cell goes to
+	// the chunks. no two voxels share an origin, so one can't be moved onto
+	// the origin of another. stored, if given, gets the voxel as the model
+	// keeps it.
+	bool update(const VoxelData& voxel, const VoxelData& next, VoxelData* stored = NULL)
+	{
+		if (!inRange(next))
+		{
+			ofLogError("VoxelData") << "update(): out of range: " << next.x << ", " << next.y << ", " << next.z;
+			return false;
+		}
+		
+		if (next.w < 1 || next.h < 1 || next.d < 1)
+		{
+			ofLogError("VoxelData") << "update(): size must be at least 1: " << next.w << " x " << next.h << " x " << next.d;
+			return false;
+		}
+		
+		bool was_unit = isUnit(voxel) && chunks.has(voxel.x, voxel.y, voxel.z);
+		int i = was_unit ? -1 : indexOf(voxel);
+		if (!was_unit && i < 0) return false;
+		
+		bool moved = voxel.x != next.x || voxel.y != next.y || voxel.z != next.z;
+		if (moved && (findOrigin(next.x, next.y, next.z) >= 0 || chunks.has(next.x, next.y, next.z)))
+		{
+			ofLogError("VoxelData") << "update(): cell taken: " << next.x << ", " << next.y << ", " << next.z;
+			return false;
+		}
+		
+		if (isUnit(next))
+		{
+			if (was_unit) eraseUnit(voxel.x, voxel.y, voxel.z);
+			else removeAt(i);
+			
+			setUnit(next.x, next.y, next.z, next.color);
+			if (stored) *stored = unitVoxel(next.x, next.y, next.z, next.color);
+			return true;
+		}
+		
+		if (was_unit)
+		{
+			eraseUnit(voxel.x, voxel.y, voxel.z);
+			
+			// a redo brings back the id the box had before
+			VoxelData v = next;
+			if (v.id < 0 || voxel_ids.count(v.id)) v.id = voxel_ids.empty() ? 0 : *voxel_ids.rbegin() + 1;
+			restore(v);
+			if (stored) *stored = v;
+			return true;
+		}
+		
+		unindexVoxel(i);
+		markDirty(voxels[i]);
+		
+		VoxelData& v = voxels[i];
+		v.x = next.x;
+		v.y = next.y;
+		v.z = next.z;
+		v.w = next.w;
+		v.h = next.h;
+		v.d = next.d;
+		v.color = next.color;
+		
+		indexVoxel(i);
+		markDirty(v);
+		revision++;
+		
+		if (stored) *stored = v;
+		return true;
 	}
 	
 	void clear()
 	{
 		voxels.clear();
+		chunks.clear();
+		index.clear();
+		bvh.clear();
+		overlapping = false;
+		markAllDirty();
+		revision++;
 	}
 	
-	vector<VoxelData>& getVoxels() { return voxels; }
+	// copies of every voxel overlapping the region. a one cell region gives
+	// all the voxels covering that cell, not just the one the index keeps.
+	void query(const VoxelRegion& r, vector<VoxelData>& result) const
+	{
+		result.clear();
+		bvh.query(r.x0, r.y0, r.z0, r.x1, r.y1, r.z1, [&](int i)
+		{
+			const VoxelData& v = voxels[i];
+			if (v.x < r.x1 && v.x + v.w > r.x0
+				&& v.y < r.y1 && v.y + v.h > r.y0
+				&& v.z < r.z1 && v.z + v.d > r.z0)
+				result.push_back(v);
+			return true;
+		});
+		
+		chunks.forEachIn(r.x0, r.y0, r.z0, r.x1, r.y1, r.z1, [&](int x, int y, int z, const ofColor& color)
+		{
+			result.push_back(unitVoxel(x, y, z, color));
+		});
+	}
+	
+	// copies the nearest voxel along the ray, false if there is none. t is
+	// where the ray enters it, normal the face it enters through (zero if
+	// the ray starts inside) and cell the one it enters the voxel through.
+	bool raycast(const ofVec3f& origin, const ofVec3f& dir, float& t, ofVec3f& normal,
+				 VoxelData& v, int cell[3]) const
+	{
+		int hit = -1;
+		float hit_t = FLT_MAX;
+		
+		bvh.raycast(origin, dir, FLT_MAX, [&](int i, float max_t)
+		{
+			const VoxelData& b = voxels[i];
+			float vt;
+			ofVec3f vn;
+			if (!VoxelBVH::intersectBox(origin, dir, ofVec3f(b.x, b.y, b.z),
+										ofVec3f(b.x + b.w, b.y + b.h, b.z + b.d), vt, vn)
+				|| vt >= max_t) return max_t;
+			
+			hit = i;
+			hit_t = vt;
+			normal = vn;
+			return vt;
+		});
+		
+		ofColor color;
+		if (chunks.raycast(origin, dir, hit_t, cell, t, normal)
+			&& chunks.get(cell[0], cell[1], cell[2], color))
+		{
+			v = unitVoxel(cell[0], cell[1], cell[2], color);
+			return true;
+		}
+		
+		if (hit < 0) return false;
+		
+		v = voxels[hit];
+		t = hit_t;
+		
+		// the cell at the entry point, inside the box
+		ofVec3f p = origin + dir * t;
+		int lo[3] = { v.x, v.y, v.z };
+		int size[3] = { v.w, v.h, v.d };
+		for (int a = 0; a < 3; a++)
+			cell[a] = ofClamp(floor(p[a]), lo[a], lo[a] + size[a] - 1);
+		
+		return true;
+	}
+	
+	// loose bounds of all voxels, false if there are none
+	bool getBounds(VoxelRegion& r) const
+	{
+		int lo[3], hi[3];
+		bool found = bvh.getBounds(lo, hi);
+		
+		int clo[3], chi[3];
+		if (chunks.getBounds(clo, chi))
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				lo[a] = found ? std::min(lo[a], clo[a]) : clo[a];
+				hi[a] = found ? std::max(hi[a], chi[a]) : chi[a];
+			}
+			found = true;
+		}
+		
+		if (!found) return false;
+		
+		r.x0 = lo[0];
+		r.y0 = lo[1];
+		r.z0 = lo[2];
+		r.x1 = hi[0];
+		r.y1 = hi[1];
+		r.z1 = hi[2];
+		return true;
+	}
+	
+	size_t size() const { return voxels.size() + chunks.size(); }
+	
+	// visits every voxel, boxes first. unit voxels come with id -1.
+	template <typename F>
+	void forEach(F f) const
+	{
+		for (int i = 0; i < voxels.size(); i++)
+			f(voxels[i]);
+		
+		VoxelData v;
+		v.id = -1;
+		v.w = v.h = v.d = 1;
+		
+		chunks.forEach([&](int x, int y, int z, const ofColor& color)
+		{
+			v.x = x;
+			v.y = y;
+			v.z = z;
+			v.color = color;
+			f(v);
+		});
+	}
+	
+	// changes whenever the model content may have changed, so caches built
+	// from it (render buffers, meshes) know when to rebuild
+	unsigned int getRevision() const { return revision; }
+	
+	// boxes of cells changed since the last call. returns false when the
+	// change can't be described by regions (load, clear, ...) and the
+	// caller should rebuild everything. meant for a single consumer.
+	bool takeDirtyRegions(vector<VoxelRegion>& regions)
+	{
+		bool partial = !dirty_all;
+		regions.swap(dirty_regions);
+		dirty_regions.clear();
+		dirty_all = false;
+		return partial;
+	}
+	
+	const VoxelChunkStore& getChunks() const { return chunks; }
+	
+	// what the last loadObj() cost
+	const VoxelImportStats& getImportStats() const { return import_stats; }
 	
 private:
 	
-	int updatedAt;
+	static VoxelData unitVoxel(int x, int y, int z, const ofColor& color)
+	{
+		VoxelData v;
+		v.id = -1;
+		v.x = x;
+		v.y = y;
+		v.z = z;
+		v.w = v.h = v.d = 1;
+		v.color = color;
+		return v;
+	}
+	
+	// only boxes the index can address get into the model, see VoxelIndex
+	static bool isUnit(const VoxelData& v)
+	{
+		return v.w == 1 && v.h == 1 && v.d == 1;
+	}
+	
+	static bool inRange(const VoxelData& v)
+	{
+		return VoxelIndex::contains(v.x, v.y, v.z, v.w, v.h, v.d);
+	}
+	
+	static void logDropped(const char* func, size_t n)
+	{
+		if (n > 0) ofLogError("VoxelData") << func << ": dropped " << n << " voxels outside the coordinate range";
+	}
+	
+	long long updatedAt;
 	string metadata;
+	unsigned int revision;
+	VoxelImportStats import_stats;
+	
+	vector<VoxelRegion> dirty_regions;
+	bool dirty_all;
+	
+	// set once two boxes share a cell; removals then have to hand the
+	// shared cells back to whoever else covers them
+	bool overlapping;
 	set<int> voxel_ids;
 	vector<VoxelData> voxels;
+	VoxelChunkStore chunks;
+	
+	// cell -> position in voxels, covering every cell of every box.
+	// where boxes overlap the voxel whose origin is the cell wins.
+	VoxelIndex index;
+	
+	// boxes by voxel position, for ray and overlap queries
+	VoxelBVH bvh;
+	
+	// the box with the voxel's origin and id. a copy without an id, e.g. a
+	// unit voxel grown into a box, matches by origin and size.
+	int indexOf(const VoxelData& voxel) const
+	{
+		if (voxels.empty()) return -1;
+		
+		int j = index.find(voxel.x, voxel.y, voxel.z);
+		if (j >= 0 && isBox(voxels[j], voxel)) return j;
+		
+		// hidden under an overlapping box
+		int found = -1;
+		bvh.query(voxel.x, voxel.y, voxel.z, voxel.x + 1, voxel.y + 1, voxel.z + 1, [&](int k)
+		{
+			if (isBox(voxels[k], voxel))
+			{
+				found = k;
+				return false;
+			}
+			return true;
+		});
+		
+		return found;
+	}
+	
+	static bool isBox(const VoxelData& v, const VoxelData& voxel)
+	{
+		if (v.x != voxel.x || v.y != voxel.y || v.z != voxel.z) return false;
+		if (voxel.id >= 0) return v.id == voxel.id;
+		return v.w == voxel.w && v.h == voxel.h && v.d == voxel.d;
+	}
+	
+	void setUnit(int x, int y, int z, const ofColor& color)
+	{
+		chunks.set(x, y, z, color);
+		markDirty(unitVoxel(x, y, z, color));
+		revision++;
+	}
+	
+	void eraseUnit(int x, int y, int z)
+	{
+		if (!chunks.has(x, y, z)) return;
+		
+		chunks.erase(x, y, z);
+		markDirty(unitVoxel(x, y, z, ofColor()));
+		revision++;
+	}
+	
+	int findOrigin(int x, int y, int z) const
+	{
+		int i = index.find(x, y, z);
+		if (i < 0) return -1;
+		
+		const VoxelData& v = voxels[i];
+		if (v.x == x && v.y == y && v.z == z) return i;
+		
+		return -1;
+	}
+	
+	void indexVoxel(int i)
+	{
+		const VoxelData& v = voxels[i];
+		
+		for (int z = v.z; z < v.z + v.d; z++)
+			for (int y = v.y; y < v.y + v.h; y++)
+				for (int x = v.x; x < v.x + v.w; x++)
+				{
+					int owner = index.find(x, y, z);
+					if (owner >= 0 && owner != i)
+					{
+						overlapping = true;
+						
+						const VoxelData& o = voxels[owner];
+						bool is_origin = (o.x == x && o.y == y && o.z == z);
+						bool is_own_origin = (v.x == x && v.y == y && v.z == z);
+						if (is_origin && !is_own_origin) continue;
+					}
+					index.set(x, y, z, i);
+				}
+		
+		// inserts, or refits if the box was already there
+		bvh.update(i, v.x, v.y, v.z, v.w, v.h, v.d);
+	}
+	
+	void unindexVoxel(int i)
+	{
+		const VoxelData& v = voxels[i];
+		
+		for (int z = v.z; z < v.z + v.d; z++)
+			for (int y = v.y; y < v.y + v.h; y++)
+				for (int x = v.x; x < v.x + v.w; x++)
+				{
+					if (index.find(x, y, z) == i)
+						index.erase(x, y, z);
+				}
+		
+		if (!overlapping) return;
+		
+		bvh.query(v.x, v.y, v.z, v.x + v.w, v.y + v.h, v.z + v.d, [&](int j)
+		{
+			const VoxelData& o = voxels[j];
+			if (j == i
+				|| o.x >= v.x + v.w || o.x + o.w <= v.x
+				|| o.y >= v.y + v.h || o.y + o.h <= v.y
+				|| o.z >= v.z + v.d || o.z + o.d <= v.z) return true;
+			
+			int x0 = max(o.x, v.x), x1 = min(o.x + o.w, v.x + v.w);
+			int y0 = max(o.y, v.y), y1 = min(o.y + o.h, v.y + v.h);
+			int z0 = max(o.z, v.z), z1 = min(o.z + o.d, v.z + v.d);
+			
+			for (int z = z0; z < z1; z++)
+				for (int y = y0; y < y1; y++)
+					for (int x = x0; x < x1; x++)
+					{
+						int owner = index.find(x, y, z);
+						bool is_own_origin = (o.x == x && o.y == y && o.z == z);
+						if (owner < 0 || is_own_origin) index.set(x, y, z, j);
+					}
+			
+			return true;
+		});
+	}
+	
+	// swap with the last element and pop, so removal is O(box volume)
+	void removeAt(int i)
+	{
+		int last = voxels.size() - 1;
+		
+		unindexVoxel(i);
+		bvh.remove(i);
+		voxel_ids.erase(voxels[i].id);
+		markDirty(voxels[i]);
+		
+		if (i != last)
+		{
+			const VoxelData& v = voxels[last];
+			
+			for (int z = v.z; z < v.z + v.d; z++)
+				for (int y = v.y; y < v.y + v.h; y++)
+					for (int x = v.x; x < v.x + v.w; x++)
+					{
+						if (index.find(x, y, z) == last)
+							index.set(x, y, z, i);
+					}
+			
+			bvh.rename(last, i);
+			voxels[i] = v;
+		}
+		
+		voxels.pop_back();
+		revision++;
+	}
+	
+	void markDirty(const VoxelData& v)
+	{
+		if (dirty_all) return;
+		
+		// nobody is consuming them, stop collecting
+		if (dirty_regions.size() >= 4096)
+		{
+			markAllDirty();
+			return;
+		}
+		
+		VoxelRegion r;
+		r.x0 = v.x;
+		r.y0 = v.y;
+		r.z0 = v.z;
+		r.x1 = v.x + v.w;
+		r.y1 = v.y + v.h;
+		r.z1 = v.z + v.d;
+		dirty_regions.push_back(r);
+	}
+	
+	void markAllDirty()
+	{
+		dirty_all = true;
+		dirty_regions.clear();
+	}
+	
+	// only after a load replaced the whole model, so it all needs remeshing.
+	// edits keep the index up to date and mark just the cells they touch.
+	void rebuildIndex()
+	{
+		markAllDirty();
+		revision++;
+		index.clear();
+		index.reserve(voxels.size());
+		overlapping = false;
+		
+		bvh.build(voxels.size(), [&](int i, int& x, int& y, int& z, int& w, int& h, int& d)
+		{
+			const VoxelData& v = voxels[i];
+			x = v.x; y = v.y; z = v.z;
+			w = v.w; h = v.h; d = v.d;
+		});
+		
+		for (int i = 0; i < voxels.size(); i++)
+		{
+			indexVoxel(i);
+		}
+	}
 };
\ No newline at end of file
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "VoxelData.h"
+#include "VoxelProfiler.h"
+#include "VoxelJournal.h"
+
+// undo / redo log that stores only the voxels each operation touched.
+// an operation is a list of edits recorded between calls to commit().
+// history is bounded by memory, the oldest operations are dropped first.
+// with a journal set, every edit and every undo / redo step is also
+// appended there and flushed once the operation is complete.
+class VoxelHistory
+{
+public:
+
+	VoxelHistory() : memory_budget(64 * 1024 * 1024), memory_used(0), journal(NULL) {}
+
+	void setJournal(VoxelJournal* j) { journal = j; }
+
+	void add(const VoxelData& after)
+	{
+		record(Edit::ADD, after, after);
+	}
+
+	void remove(const VoxelData& before)
+	{
+		record(Edit::REMOVE, before, before);
+	}
+
+	void update(const VoxelData& before, const VoxelData& after)
+	{
+		record(Edit::UPDATE, before, after);
+	}
+
+	// every voxel of the model as one operation. the journal gets a single
+	// clear record instead of one per voxel.
+	void removeAll(const Voxel& voxels)
+	{
+		commit();
+		if (voxels.size() == 0) return;
+
+		pending.edits.reserve(voxels.size());
+		voxels.forEach([&](const VoxelData& v)
+		{
+			Edit e;
+			e.type = Edit::REMOVE;
+			e.before = e.after = v;
+			pending.edits.push_back(e);
+		});
+
+		pending.cleared = true;
+		if (journal) journal->clear();
+
+		commit();
+	}
+
+	// colour changes on the same voxel (e.g. dragging a slider) fold into
+	// the previous operation instead of creating one per step
+	void updateColor(const VoxelData& before, const VoxelData& after)
+	{
+		if (pending.edits.empty() && !undo_stack.empty())
+		{
+			Operation& last = undo_stack.back();
+			if (last.edits.size() == 1 && last.color_only)
+			{
+				Edit& e = last.edits[0];
+				if (e.after.id == after.id
+					&& e.after.x == after.x && e.after.y == after.y && e.after.z == after.z)
+				{
+					e.after.color = after.color;
+					if (journal)
+					{
+						journal->update(before, after);
+						journal->flush();
+					}
+					return;
+				}
+			}
+		}
+
+		update(before, after);
+		commit();
+		if (!undo_stack.empty()) undo_stack.back().color_only = true;
+	}
+
+	void commit()
+	{
+		if (journal) journal->flush();
+		if (pending.edits.empty()) return;
+
+		VOXEL_PROFILE("history.commit");
+
+		pending.bytes = sizeof(Operation) + pending.edits.capacity() * sizeof(Edit);
+		memory_used += pending.bytes;
+
+		undo_stack.push_back(Operation());
+		undo_stack.back().swap(pending);
+
+		releaseRedo();
+		trim();
+	}
+
+	bool undo(Voxel& voxels)
+	{
+		commit();
+		if (undo_stack.empty()) return false;
+
+		Operation& op = undo_stack.back();
+		for (int i = op.edits.size() - 1; i >= 0; i--)
+		{
+			const Edit& e = op.edits[i];
+			switch (e.type)
+			{
+				case Edit::ADD: voxels.remove(e.after); break;
+				case Edit::REMOVE: voxels.restore(e.before); break;
+				case Edit::UPDATE: voxels.update(e.after, e.before); break;
+			}
+
+			if (journal)
+			{
+				switch (e.type)
+				{
+					case Edit::ADD: journal->remove(e.after); break;
+					case Edit::REMOVE: journal->add(e.before); break;
+					case Edit::UPDATE: journal->update(e.after, e.before); break;
+				}
+			}
+		}
+
+		if (journal) journal->flush();
+
+		redo_stack.push_back(Operation());
+		redo_stack.back().swap(op);
+		undo_stack.pop_back();
+
+		return true;
+	}
+
+	bool redo(Voxel& voxels)
+	{
+		commit();
+		if (redo_stack.empty()) return false;
+
+		Operation& op = redo_stack.back();
+		for (int i = 0; i < op.edits.size(); i++)
+		{
+			const Edit& e = op.edits[i];
+			switch (e.type)
+			{
+				case Edit::ADD: voxels.restore(e.after); break;
+				case Edit::REMOVE: voxels.remove(e.before); break;
+				case Edit::UPDATE: voxels.update(e.before, e.after); break;
+			}
+
+			if (journal && !op.cleared)
+			{
+				switch (e.type)
+				{
+					case Edit::ADD: journal->add(e.after); break;
+					case Edit::REMOVE: journal->remove(e.before); break;
+					case Edit::UPDATE: journal->update(e.before, e.after); break;
+				}
+			}
+		}
+
+		if (journal)
+		{
+			if (op.cleared) journal->clear();
+			journal->flush();
+		}
+
+		undo_stack.push_back(Operation());
+		undo_stack.back().swap(op);
+		redo_stack.pop_back();
+
+		return true;
+	}
+
+	void clear()
+	{
+		undo_stack.clear();
+		redo_stack.clear();
+		pending = Operation();
+		memory_used = 0;
+	}
+
+	bool canUndo() const { return !undo_stack.empty() || !pending.edits.empty(); }
+	bool canRedo() const { return !redo_stack.empty(); }
+
+	void setMemoryBudget(size_t bytes)
+	{
+		memory_budget = bytes;
+		trim();
+	}
+
+	size_t getMemoryBudget() const { return memory_budget; }
+	size_t getMemoryUsage() const { return memory_used; }
+
+private:
+
+	struct Edit
+	{
+		enum Type { ADD, REMOVE, UPDATE } type;
+		VoxelData before, after;
+	};
+
+	struct Operation
+	{
+		vector<Edit> edits;
+		size_t bytes;
+		bool color_only;
+		bool cleared;
+
+		Operation() : bytes(0), color_only(false), cleared(false) {}
+
+		void swap(Operation& o)
+		{
+			edits.swap(o.edits);
+			std::swap(bytes, o.bytes);
+			std::swap(color_only, o.color_only);
+			std::swap(cleared, o.cleared);
+		}
+	};
+
+	deque<Operation> undo_stack, redo_stack;
+	Operation pending;
+
+	size_t memory_budget;
+	size_t memory_used;
+
+	VoxelJournal* journal;
+
+	void record(Edit::Type type, const VoxelData& before, const VoxelData& after)
+	{
+		Edit e;
+		e.type = type;
+		e.before = before;
+		e.after = after;
+		pending.edits.push_back(e);
+
+		if (journal)
+		{
+			switch (type)
+			{
+				case Edit::ADD: journal->add(after); break;
+				case Edit::REMOVE: journal->remove(before); break;
+				case Edit::UPDATE: journal->update(before, after); break;
+			}
+		}
+	}
+
+	void releaseRedo()
+	{
+		for (int i = 0; i < redo_stack.size(); i++)
+			memory_used -= redo_stack[i].bytes;
+		redo_stack.clear();
+	}
+
+	void trim()
+	{
+		while (memory_used > memory_budget && !undo_stack.empty())
+		{
+			memory_used -= undo_stack.front().bytes;
+			undo_stack.pop_front();
+		}
+	}
+};
@@ -0,0 +1,1209 @@
+#pragma once
+
+#include "ofMain.h"
+#include "VoxelIndex.h"
+#include "VoxelTriBox.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+// assimp straight, ofxAssimpModelLoader would upload every mesh and
+// texture to GL
+#include "assimp.h"
+#include "aiScene.h"
+#include "aiPostProcess.h"
+
+// long running loads, saves and imports call this with the fraction done
+// so far. returning false cancels the operation, which then fails.
+typedef std::function<bool(float)> VoxelProgress;
+
+// what an import cost. hits counts face and cell pairs, so a cell several
+// faces touch counts once for each.
+struct VoxelImportStats
+{
+	size_t faces;
+	size_t cells_tested;    // cells an overlap test ran on
+	size_t hits;
+	size_t filled;          // inside cells a solid import added
+	bool flooded;           // a mesh was open, the inside came from a flood fill
+
+	VoxelImportStats() : faces(0), cells_tested(0), hits(0), filled(0), flooded(false) {}
+
+	float getTestedPerHit() const { return hits ? cells_tested / (float)hits : 0; }
+};
+
+// accumulates voxelizer hits over [0, nx) x [0, ny) x [0, nz). a bit per
+// cell says whether it is set and a flat array holds the colours; volumes
+// too large for that fall back to a hash from cell to colour. set() keeps
+// the last colour of a cell, add() the mean of all colours added to it.
+// forEach() visits cells in x, y, z order.
+class VoxelImportGrid
+{
+public:
+
+	enum { MAX_DENSE_CELLS = 1 << 26 };
+
+	VoxelImportGrid() : nx(0), ny(0), nz(0), dense(true), num_set(0) {}
+
+	void resize(int sx, int sy, int sz)
+	{
+		nx = std::max(sx, 0);
+		ny = std::max(sy, 0);
+		nz = std::max(sz, 0);
+		num_set = 0;
+
+		uint64_t cells = (uint64_t)nx * ny * nz;
+		dense = cells <= MAX_DENSE_CELLS;
+
+		bits.clear();
+		colors.clear();
+		coords.clear();
+		sparse.clear();
+		mixed.clear();
+		sums.clear();
+
+		if (dense)
+		{
+			bits.assign((cells + 63) / 64, 0);
+			colors.resize(cells);
+		}
+	}
+
+	void set(int x, int y, int z, const ofColor& color)
+	{
+		if ((unsigned)x >= (unsigned)nx || (unsigned)y >= (unsigned)ny || (unsigned)z >= (unsigned)nz)
+		{
+			ofLogError("VoxelImportGrid") << "set(): cell out of range: " << x << ", " << y << ", " << z;
+			return;
+		}
+
+		if (dense)
+		{
+			size_t i = cell(x, y, z);
+			uint64_t mask = 1ULL << (i & 63);
+			if ((bits[i >> 6] & mask) == 0)
+			{
+				bits[i >> 6] |= mask;
+				num_set++;
+			}
+			colors[i] = color;
+		}
+		else
+		{
+			int i = sparse.find(x, y, z);
+			if (i < 0)
+			{
+				sparse.set(x, y, z, colors.size());
+				colors.push_back(color);
+
+				Coord c = { x, y, z, (int)coords.size() };
+				coords.push_back(c);
+				num_set++;
+			}
+			else colors[i] = color;
+		}
+
+		if (!sums.empty()) mixed.erase(x, y, z);
+	}
+
+	void add(int x, int y, int z, const ofColor& color)
+	{
+		ofColor* c = lookup(x, y, z);
+		if (c == NULL)
+		{
+			set(x, y, z, color);
+			return;
+		}
+
+		// only cells added more than once keep a sum
+		int s = mixed.find(x, y, z);
+		if (s < 0)
+		{
+			s = sums.size();
+			mixed.set(x, y, z, s);
+			sums.push_back(Sum(*c));
+		}
+
+		Sum& sum = sums[s];
+		sum.r += color.r;
+		sum.g += color.g;
+		sum.b += color.b;
+		sum.a += color.a;
+		sum.n++;
+
+		c->set((sum.r + sum.n / 2) / sum.n, (sum.g + sum.n / 2) / sum.n,
+			   (sum.b + sum.n / 2) / sum.n, (sum.a + sum.n / 2) / sum.n);
+	}
+
+	bool has(int x, int y, int z) const
+	{
+		if ((unsigned)x >= (unsigned)nx || (unsigned)y >= (unsigned)ny || (unsigned)z >= (unsigned)nz)
+			return false;
+
+		if (dense)
+		{
+			size_t i = cell(x, y, z);
+			return (bits[i >> 6] >> (i & 63)) & 1;
+		}
+		return sparse.find(x, y, z) >= 0;
+	}
+
+	bool get(int x, int y, int z, ofColor& color) const
+	{
+		const ofColor* c = const_cast<VoxelImportGrid*>(this)->lookup(x, y, z);
+		if (c == NULL) return false;
+
+		color = *c;
+		return true;
+	}
+
+	size_t size() const { return num_set; }
+	int getWidth() const { return nx; }
+	int getHeight() const { return ny; }
+	int getDepth() const { return nz; }
+	bool isDense() const { return dense; }
+
+	size_t memoryUsage() const
+	{
+		// the hash keeps at most two 12 byte slots per entry
+		return bits.capacity() * sizeof(uint64_t) + colors.capacity() * sizeof(ofColor)
+			+ coords.capacity() * sizeof(Coord) + (dense ? 0 : num_set * 2 * 12)
+			+ sums.capacity() * sizeof(Sum) + sums.size() * 2 * 12;
+	}
+
+	// f(x, y, z, color)
+	template <typename F>
+	void forEach(F f) const
+	{
+		if (dense)
+		{
+			// z is the fastest axis, so this is a straight walk over the bits
+			for (size_t w = 0; w < bits.size(); w++)
+			{
+				uint64_t word = bits[w];
+				for (int b = 0; word; b++, word >>= 1)
+				{
+					if ((word & 1) == 0) continue;
+
+					size_t i = w * 64 + b;
+					int z = i % nz;
+					int y = (i / nz) % ny;
+					int x = i / ((size_t)nz * ny);
+					f(x, y, z, colors[i]);
+				}
+			}
+			return;
+		}
+
+		vector<Coord> sorted(coords);
+		std::sort(sorted.begin(), sorted.end());
+
+		for (size_t k = 0; k < sorted.size(); k++)
+			f(sorted[k].x, sorted[k].y, sorted[k].z, colors[sorted[k].i]);
+	}
+
+private:
+
+	int nx, ny, nz;
+	bool dense;
+	size_t num_set;
+
+	struct Coord
+	{
+		int x, y, z, i;
+
+		bool operator<(const Coord& o) const
+		{
+			if (x != o.x) return x < o.x;
+			if (y != o.y) return y < o.y;
+			return z < o.z;
+		}
+	};
+
+	vector<uint64_t> bits;
+	vector<ofColor> colors;
+
+	// when not dense: cell -> colors, and the cells in insertion order
+	VoxelIndex sparse;
+	vector<Coord> coords;
+
+	struct Sum
+	{
+		uint32_t r, g, b, a, n;
+
+		Sum(const ofColor& c) : r(c.r), g(c.g), b(c.b), a(c.a), n(1) {}
+	};
+
+	// cells add() saw more than once -> sums
+	VoxelIndex mixed;
+	vector<Sum> sums;
+
+	size_t cell(int x, int y, int z) const
+	{
+		return ((size_t)x * ny + y) * nz + z;
+	}
+
+	ofColor* lookup(int x, int y, int z)
+	{
+		if ((unsigned)x >= (unsigned)nx || (unsigned)y >= (unsigned)ny || (unsigned)z >= (unsigned)nz)
+			return NULL;
+
+		if (dense)
+		{
+			size_t i = cell(x, y, z);
+			if (((bits[i >> 6] >> (i & 63)) & 1) == 0) return NULL;
+			return &colors[i];
+		}
+
+		int i = sparse.find(x, y, z);
+		return i < 0 ? NULL : &colors[i];
+	}
+};
+
+// fills the inside of closed meshes once their surface is in the grid. each
+// mesh casts rays along +y through the column centres and the cells between
+// an odd and the next even crossing are inside, so the work follows the
+// surface and the filled volume. a column with an odd number of crossings
+// means a mesh is not closed; then the empty cells the surface walls off
+// from the grid border are filled instead. filled cells take the colour of
+// the surface below them. on_progress is called with the fraction done and
+// cancels the fill when it returns false.
+class VoxelSolidFill
+{
+public:
+
+	enum
+	{
+		MAX_FLOOD_CELLS = 1 << 30,   // flood fill costs a bit per cell, larger grids stay hollow
+		FLOOD_BATCH = 1 << 14,       // spans filled between progress calls
+	};
+
+	// lo and step map model units to cells like in the surface pass.
+	// false if cancelled.
+	static bool fill(VoxelImportGrid& grid, const vector<ofMesh>& meshes, const ofVec3f& lo, float step,
+					 int num_threads, VoxelImportStats& stats, const VoxelProgress& on_progress = VoxelProgress())
+	{
+		vector<vector<Run> > runs;
+		bool closed = true;
+
+		for (int i = 0; i < meshes.size() && closed; i++)
+		{
+			closed = fillParity(grid, meshes[i], lo, step, num_threads, runs);
+			stats.filled += apply(grid, runs);
+
+			if (on_progress && !on_progress(0.5f * (i + 1) / meshes.size())) return false;
+		}
+
+		if (closed) return true;
+
+		stats.flooded = true;
+		if (!fillFlood(grid, num_threads, runs, [&](float f) { return !on_progress || on_progress(0.5f + 0.5f * f); }))
+			return false;
+
+		stats.filled += apply(grid, runs);
+		return true;
+	}
+
+private:
+
+	// cells [y0, y1) of column x, z
+	struct Run
+	{
+		int x, z, y0, y1;
+	};
+
+	struct Crossing
+	{
+		int column;
+		float y;
+
+		bool operator<(const Crossing& o) const
+		{
+			if (column != o.column) return column < o.column;
+			return y < o.y;
+		}
+	};
+
+	struct Point
+	{
+		double x, y, z;
+	};
+
+	// f(slab, begin, end) over slabs of x, each slab writes runs[slab]
+	template <typename F>
+	static void forEachSlab(int nx, int num_threads, vector<vector<Run> >& runs, F f)
+	{
+		int num_slabs = std::min(nx, num_threads * 4);
+		int width = num_slabs ? (nx + num_slabs - 1) / num_slabs : 0;
+
+		runs.assign(num_slabs, vector<Run>());
+		std::atomic<int> next(0);
+
+		auto worker = [&]()
+		{
+			int slab;
+			while ((slab = next++) < num_slabs)
+			{
+				f(slab, slab * width, std::min(nx, (slab + 1) * width));
+			}
+		};
+
+		vector<std::thread> threads;
+		for (int i = 1; i < std::min(num_threads, num_slabs); i++)
+		{
+			threads.push_back(std::thread(worker));
+		}
+		worker();
+		for (int i = 0; i < threads.size(); i++)
+		{
+			threads[i].join();
+		}
+	}
+
+	// twice the signed area of a, b, p in the xz plane. the same edge gives
+	// exactly the negated value when walked the other way, so a column on
+	// an edge shared by two faces is counted by one of them only.
+	static double edge(const Point& a, const Point& b, double px, double pz)
+	{
+		bool forward = a.x < b.x || (a.x == b.x && a.z < b.z);
+		const Point& p0 = forward ? a : b;
+		const Point& p1 = forward ? b : a;
+		double e = (p1.x - p0.x) * (pz - p0.z) - (p1.z - p0.z) * (px - p0.x);
+		return forward ? e : -e;
+	}
+
+	// which of the two faces along an edge takes columns exactly on it
+	static bool owns(const Point& a, const Point& b)
+	{
+		return b.z > a.z || (b.z == a.z && b.x < a.x);
+	}
+
+	static bool inside(double e, const Point& a, const Point& b)
+	{
+		return e > 0 || (e == 0 && owns(a, b));
+	}
+
+	static bool fillParity(const VoxelImportGrid& grid, const ofMesh& mesh, const ofVec3f& lo, float step,
+						   int num_threads, vector<vector<Run> >& runs)
+	{
+		const int nx = grid.getWidth(), ny = grid.getHeight(), nz = grid.getDepth();
+		const vector<ofVec3f>& vertices = mesh.getVertices();
+		const int num_faces = mesh.getNumIndices() / 3;
+
+		// column centres sit on whole numbers
+		vector<Point> points(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			points[i].x = ((double)vertices[i].x - lo.x) / step - 0.5;
+			points[i].y = ((double)vertices[i].y - lo.y) / step;
+			points[i].z = ((double)vertices[i].z - lo.z) / step - 0.5;
+		}
+
+		int num_slabs = std::max(1, std::min(nx, num_threads * 4));
+		int width = (nx + num_slabs - 1) / num_slabs;
+
+		// faces by the slabs their columns fall in
+		vector<vector<int> > slab_faces(num_slabs);
+		for (int f = 0; f < num_faces; f++)
+		{
+			double x0 = points[mesh.getIndex(f * 3)].x, x1 = x0;
+			for (int k = 1; k < 3; k++)
+			{
+				double x = points[mesh.getIndex(f * 3 + k)].x;
+				x0 = std::min(x0, x);
+				x1 = std::max(x1, x);
+			}
+
+			int c0 = std::max<double>(ceil(x0), 0);
+			int c1 = std::min<double>(floor(x1), nx - 1);
+			if (c0 > c1) continue;
+
+			for (int slab = c0 / width; slab <= c1 / width; slab++)
+			{
+				slab_faces[slab].push_back(f);
+			}
+		}
+
+		std::atomic<bool> closed(true);
+
+		forEachSlab(nx, num_threads, runs, [&](int slab, int begin, int end)
+		{
+			vector<Crossing> crossings;
+
+			const vector<int>& faces = slab_faces[slab];
+			for (int i = 0; i < faces.size(); i++)
+			{
+				const Point* a = &points[mesh.getIndex(faces[i] * 3)];
+				const Point* b = &points[mesh.getIndex(faces[i] * 3 + 1)];
+				const Point* c = &points[mesh.getIndex(faces[i] * 3 + 2)];
+
+				// faces seen edge on are never crossed
+				double area = edge(*a, *b, c->x, c->z);
+				if (area == 0) continue;
+				if (area < 0) std::swap(b, c);
+
+				int x0 = std::max<double>(ceil(std::min(a->x, std::min(b->x, c->x))), begin);
+				int x1 = std::min<double>(floor(std::max(a->x, std::max(b->x, c->x))), end - 1);
+				int z0 = std::max<double>(ceil(std::min(a->z, std::min(b->z, c->z))), 0);
+				int z1 = std::min<double>(floor(std::max(a->z, std::max(b->z, c->z))), nz - 1);
+
+				for (int x = x0; x <= x1; x++)
+				{
+					for (int z = z0; z <= z1; z++)
+					{
+						double wa = edge(*b, *c, x, z);
+						double wb = edge(*c, *a, x, z);
+						double wc = edge(*a, *b, x, z);
+
+						if (!inside(wa, *b, *c) || !inside(wb, *c, *a) || !inside(wc, *a, *b)) continue;
+
+						double sum = wa + wb + wc;
+						if (sum <= 0) continue;
+
+						Crossing k = { (x - begin) * nz + z, (float)((wa * a->y + wb * b->y + wc * c->y) / sum) };
+						crossings.push_back(k);
+					}
+				}
+			}
+
+			std::sort(crossings.begin(), crossings.end());
+
+			for (size_t i = 0; i < crossings.size(); )
+			{
+				size_t j = i;
+				while (j < crossings.size() && crossings[j].column == crossings[i].column) j++;
+
+				if ((j - i) % 2)
+				{
+					closed = false;
+					return;
+				}
+
+				int x = begin + crossings[i].column / nz;
+				int z = crossings[i].column % nz;
+
+				// cells with their centre between the two crossings
+				for (size_t k = i; k < j; k += 2)
+				{
+					int y0 = std::max<float>(ceil(crossings[k].y - 0.5f), 0);
+					int y1 = std::min<float>(floor(crossings[k + 1].y - 0.5f) + 1, ny);
+
+					Run r = { x, z, y0, y1 };
+					if (y0 < y1) runs[slab].push_back(r);
+				}
+				i = j;
+			}
+		});
+
+		if (closed == false) runs.clear();
+		return closed;
+	}
+
+	// marks the empty cells reachable from the grid border, the rest of the
+	// empty cells are inside. a scanline fill along z: the stack holds one
+	// seed per span of open cells rather than one entry per cell, the border
+	// is seeded a row at a time and each row is drained before the next, and
+	// on_progress is checked every FLOOD_BATCH spans. false if cancelled.
+	static bool fillFlood(const VoxelImportGrid& grid, int num_threads, vector<vector<Run> >& runs,
+						  const VoxelProgress& on_progress)
+	{
+		const int nx = grid.getWidth(), ny = grid.getHeight(), nz = grid.getDepth();
+		const uint64_t cells = (uint64_t)nx * ny * nz;
+
+		runs.clear();
+
+		if (cells > MAX_FLOOD_CELLS)
+		{
+			ofLogError("VoxelSolidFill") << "fill(): " << cells << " cells are too many to flood fill";
+			return true;
+		}
+
+		vector<uint64_t> outside((cells + 63) / 64, 0);
+
+		struct Seed
+		{
+			int x, y, z;
+		};
+
+		vector<Seed> stack;
+
+		auto open = [&](int x, int y, int z)
+		{
+			size_t i = ((size_t)x * ny + y) * nz + z;
+			return !((outside[i >> 6] >> (i & 63)) & 1) && !grid.has(x, y, z);
+		};
+
+		// one seed per run of open cells of the row within [z0, z1)
+		auto seedRow = [&](int x, int y, int z0, int z1)
+		{
+			bool in_span = false;
+			for (int z = z0; z < z1; z++)
+			{
+				bool o = open(x, y, z);
+				if (o && !in_span)
+				{
+					Seed s = { x, y, z };
+					stack.push_back(s);
+				}
+				in_span = o;
+			}
+		};
+
+		size_t marked = 0, spans = 0;
+		const float empty = std::max<uint64_t>(cells - grid.size(), 1);
+
+		auto drain = [&]()
+		{
+			while (!stack.empty())
+			{
+				Seed s = stack.back();
+				stack.pop_back();
+
+				// already reached through another seed
+				if (!open(s.x, s.y, s.z)) continue;
+
+				int z0 = s.z, z1 = s.z + 1;
+				while (z0 > 0 && open(s.x, s.y, z0 - 1)) z0--;
+				while (z1 < nz && open(s.x, s.y, z1)) z1++;
+
+				for (int z = z0; z < z1; z++)
+				{
+					size_t i = ((size_t)s.x * ny + s.y) * nz + z;
+					outside[i >> 6] |= 1ULL << (i & 63);
+				}
+				marked += z1 - z0;
+
+				if (s.x > 0) seedRow(s.x - 1, s.y, z0, z1);
+				if (s.x < nx - 1) seedRow(s.x + 1, s.y, z0, z1);
+				if (s.y > 0) seedRow(s.x, s.y - 1, z0, z1);
+				if (s.y < ny - 1) seedRow(s.x, s.y + 1, z0, z1);
+
+				if (++spans % FLOOD_BATCH == 0 && !on_progress(marked / empty)) return false;
+			}
+			return true;
+		};
+
+		for (int x = 0; x < nx; x++)
+		{
+			for (int y = 0; y < ny; y++)
+			{
+				if (x == 0 || y == 0 || x == nx - 1 || y == ny - 1)
+				{
+					seedRow(x, y, 0, nz);
+				}
+				else
+				{
+					seedRow(x, y, 0, 1);
+					seedRow(x, y, nz - 1, nz);
+				}
+
+				if (!drain()) return false;
+			}
+		}
+
+		forEachSlab(nx, num_threads, runs, [&](int slab, int begin, int end)
+		{
+			for (int x = begin; x < end; x++)
+			{
+				for (int z = 0; z < nz; z++)
+				{
+					int y0 = -1;
+					for (int y = 0; y <= ny; y++)
+					{
+						size_t i = ((size_t)x * ny + y) * nz + z;
+						bool empty = y < ny && !((outside[i >> 6] >> (i & 63)) & 1) && !grid.has(x, y, z);
+
+						if (empty && y0 < 0) y0 = y;
+						if (!empty && y0 >= 0)
+						{
+							Run r = { x, z, y0, y };
+							runs[slab].push_back(r);
+							y0 = -1;
+						}
+					}
+				}
+			}
+		});
+
+		return true;
+	}
+
+	// sets the empty cells of the runs, returns how many
+	static size_t apply(VoxelImportGrid& grid, const vector<vector<Run> >& runs)
+	{
+		size_t filled = 0;
+
+		for (int s = 0; s < runs.size(); s++)
+		{
+			for (int k = 0; k < runs[s].size(); k++)
+			{
+				const Run& r = runs[s][k];
+
+				ofColor color(255);
+				grid.get(r.x, r.y0 - 1, r.z, color);
+
+				for (int y = r.y0; y < r.y1; y++)
+				{
+					ofColor c;
+					if (grid.get(r.x, y, r.z, c)) color = c;
+					else
+					{
+						grid.set(r.x, y, r.z, color);
+						filled++;
+					}
+				}
+			}
+		}
+		return filled;
+	}
+};
+
+// how loadObj() lays the grid over a model
+struct VoxelImportOptions
+{
+	// model units per cell. when 0 the step comes from resolution
+	float voxel_size;
+
+	// cells along the longest side of the bounds. when 0 too, the model's
+	// footprint is fit into 80 x 60 cells of the editor floor
+	int resolution;
+
+	// voxelize only this box, in model units, instead of the bounds of all
+	// meshes
+	bool use_bounds;
+	ofVec3f bounds_min, bounds_max;
+
+	// cells this many times larger, each kept as a box over the cells it
+	// stands for. a quick preview at the model's full size.
+	int coarse_factor;
+
+	// fill the inside of closed meshes too, not just their surface
+	bool solid;
+
+	// threads to voxelize on, 0 for one per core
+	int num_threads;
+
+	VoxelImportOptions() : voxel_size(0), resolution(0), use_bounds(false), coarse_factor(1), solid(false),
+						   num_threads(0) {}
+
+	int getNumThreads() const
+	{
+		return num_threads > 0 ? num_threads : std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	VoxelImportOptions preview(int factor = 4) const
+	{
+		VoxelImportOptions o = *this;
+		o.coarse_factor = factor;
+		return o;
+	}
+};
+
+// an obj file loaded once and voxelized as often as needed, say a coarse
+// preview first and the full resolution on demand. all meshes share one
+// grid with cell (0, 0, 0) at the minimum of the import bounds.
+class VoxelObjImporter
+{
+public:
+
+	VoxelObjImporter() : num_faces(0) {}
+
+	bool open(const string& path)
+	{
+		close();
+
+		// FIXME: workaround for assimp parsing bug.
+		// assimp parseFile() has a bug that will crash if the last line of *.obj file is not a newline.
+		// This hack copies the original *.obj file and then append a newline to it.
+		string patched_path = path + ".patched.obj";
+		ofFile::copyFromTo(path, patched_path);
+		ofFile patched_file = ofFile(patched_path, ofFile::Append);
+		patched_file << "\n";
+		patched_file.close();
+
+		// Load the patched file, with the flags ofxAssimpModelLoader uses
+		unsigned int flags = aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_Triangulate | aiProcess_FlipUVs;
+		const aiScene* scene = aiImportFile(ofToDataPath(patched_path).c_str(), flags);
+		ofFile::removeFile(patched_path);
+
+		if (scene == NULL)
+		{
+			ofLogError("VoxelObjImporter") << "open(): " << path << ": " << aiGetErrorString();
+			return false;
+		}
+
+		for (int mesh_idx = 0; mesh_idx < scene->mNumMeshes; mesh_idx++)
+		{
+			const aiMesh* ai_mesh = scene->mMeshes[mesh_idx];
+
+			// Only support TRIANGLES
+			if ((ai_mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0)
+			{
+				ofLogError("VoxelObjImporter") << "open(): not supported primitive types: " << ai_mesh->mPrimitiveTypes;
+				continue;
+			}
+
+			ofMesh mesh;
+			toMesh(ai_mesh, mesh);
+
+			const vector<ofVec3f>& vertices = mesh.getVertices();
+			if (vertices.empty() || mesh.getNumIndices() == 0) continue;
+
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				if (meshes.empty() && i == 0) bounds_min = bounds_max = vertices[i];
+
+				for (int c = 0; c < 3; c++)
+				{
+					bounds_min[c] = std::min(bounds_min[c], vertices[i][c]);
+					bounds_max[c] = std::max(bounds_max[c], vertices[i][c]);
+				}
+			}
+
+			// Decode the diffuse texture straight from its file
+			ofPixels mesh_pixels;
+			string texture_path = getTexturePath(scene->mMaterials[ai_mesh->mMaterialIndex], path);
+			if (!texture_path.empty() && ofLoadImage(mesh_pixels, texture_path) == false)
+			{
+				ofLogError("VoxelObjImporter") << "open(): could not load texture " << texture_path;
+			}
+
+			meshes.push_back(mesh);
+			pixels.push_back(mesh_pixels);
+			num_faces += mesh.getNumIndices() / 3;
+		}
+
+		aiReleaseImport(scene);
+
+		this->path = path;
+		return true;
+	}
+
+	void close()
+	{
+		path.clear();
+		meshes.clear();
+		pixels.clear();
+		num_faces = 0;
+		bounds_min.set(0, 0, 0);
+		bounds_max.set(0, 0, 0);
+	}
+
+	bool isOpen() const { return !path.empty(); }
+	const string& getPath() const { return path; }
+	size_t getNumFaces() const { return num_faces; }
+
+	// of all meshes, false if there are none
+	bool getBounds(ofVec3f& lo, ofVec3f& hi) const
+	{
+		lo = bounds_min;
+		hi = bounds_max;
+		return !meshes.empty();
+	}
+
+	// the box voxelize() covers and its model units per cell, before
+	// coarse_factor. the step is 0 when there is nothing to cover.
+	float getStep(const VoxelImportOptions& options, ofVec3f& lo, ofVec3f& hi) const
+	{
+		if (options.use_bounds)
+		{
+			lo = options.bounds_min;
+			hi = options.bounds_max;
+		}
+		else if (getBounds(lo, hi) == false) return 0;
+
+		ofVec3f size = hi - lo;
+		if (!(size.x >= 0 && size.y >= 0 && size.z >= 0)) return 0;
+
+		float step;
+		if (options.voxel_size > 0) step = options.voxel_size;
+		else if (options.resolution > 0) step = std::max(size.x, std::max(size.y, size.z)) / options.resolution;
+		else step = (size.x * 60 < size.z * 80) ? size.z / 60 : size.x / 80;
+
+		return step > 0 ? step : 0;
+	}
+
+	// on_progress, if given, is called on the calling thread with the
+	// fraction done so far. a solid import spends the second half filling.
+	bool voxelize(const VoxelImportOptions& options, VoxelImportGrid& grid, VoxelImportStats& stats,
+				  VoxelProgress on_progress = VoxelProgress()) const
+	{
+		stats = VoxelImportStats();
+
+		ofVec3f lo, hi;
+		float step = getStep(options, lo, hi) * std::max(options.coarse_factor, 1);
+
+		if (!(step > 0))
+		{
+			ofLogError("VoxelObjImporter") << "voxelize(): nothing to voxelize in " << path;
+			return false;
+		}
+
+		// cells end at ceil(extent / step), one more for rounding
+		int grid_size[3];
+		for (int c = 0; c < 3; c++)
+		{
+			double cells = ceil((hi[c] - lo[c]) / step) + 1;
+			if (cells > (1 << 20))
+			{
+				ofLogError("VoxelObjImporter") << "voxelize(): " << cells << " cells along one axis is too many";
+				return false;
+			}
+			grid_size[c] = cells;
+		}
+
+		grid.resize(grid_size[0], grid_size[1], grid_size[2]);
+
+		size_t faces_done = 0;
+		std::atomic<bool> cancelled(false);
+		const float faces_share = options.solid ? 0.5f : 1.0f;
+
+		for (int mesh_num = 0; mesh_num < meshes.size(); mesh_num++)
+		{
+			const ofMesh& mesh = meshes[mesh_num];
+			const vector<ofVec3f>& vertices = mesh.getVertices();
+			const ofPixels& mesh_pixels = pixels[mesh_num];
+
+			// Faces are voxelized in blocks, on as many threads as there are
+			// cores. Each block keeps its own hits and blocks are merged in
+			// face order whatever thread ran them, so the averaged colours
+			// come out the same on every run and thread count.
+			const int num_mesh_faces = mesh.getNumIndices() / 3;
+			const int num_blocks = (num_mesh_faces + FACES_PER_BLOCK - 1) / FACES_PER_BLOCK;
+
+			vector<vector<VoxelHit> > blocks(num_blocks);
+			vector<size_t> blocks_tested(num_blocks, 0);
+			std::atomic<int> next_block(0), blocks_done(0);
+
+			auto worker = [&](bool report)
+			{
+				int block;
+				while (!cancelled && (block = next_block++) < num_blocks)
+				{
+					int end = std::min(num_mesh_faces, (block + 1) * FACES_PER_BLOCK);
+					for (int face = block * FACES_PER_BLOCK; face < end; face++)
+					{
+						voxelizeFace(mesh, vertices, mesh_pixels, face * 3, lo.x, lo.y, lo.z, step, grid_size,
+									 blocks[block], blocks_tested[block]);
+					}
+
+					int done = ++blocks_done;
+					if (report && on_progress)
+					{
+						size_t n = std::min(num_mesh_faces, done * FACES_PER_BLOCK);
+						if (!on_progress(faces_share * (faces_done + n) / num_faces)) cancelled = true;
+					}
+				}
+			};
+
+			int num_threads = std::max(1, std::min(num_blocks, options.getNumThreads()));
+
+			vector<std::thread> threads;
+			for (int i = 1; i < num_threads; i++)
+			{
+				threads.push_back(std::thread(worker, false));
+			}
+			worker(true);
+			for (int i = 0; i < threads.size(); i++)
+			{
+				threads[i].join();
+			}
+
+			if (cancelled)
+			{
+				ofLogNotice("VoxelObjImporter") << "voxelize(): cancelled";
+				return false;
+			}
+
+			for (int block = 0; block < num_blocks; block++)
+			{
+				const vector<VoxelHit>& hits = blocks[block];
+				stats.cells_tested += blocks_tested[block];
+				stats.hits += hits.size();
+
+				for (int i = 0; i < hits.size(); i++)
+				{
+					grid.add(hits[i].x, hits[i].y, hits[i].z, hits[i].color);
+				}
+				vector<VoxelHit>().swap(blocks[block]);
+			}
+
+			faces_done += num_mesh_faces;
+		}
+
+		stats.faces = faces_done;
+
+		if (options.solid)
+		{
+			VoxelProgress fill_progress;
+			if (on_progress) fill_progress = [&](float f) { return on_progress(0.5f + 0.5f * f); };
+
+			if (!VoxelSolidFill::fill(grid, meshes, lo, step, options.getNumThreads(), stats, fill_progress))
+			{
+				ofLogNotice("VoxelObjImporter") << "voxelize(): cancelled";
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+private:
+
+	string path;
+	vector<ofMesh> meshes;
+	vector<ofPixels> pixels;
+	size_t num_faces;
+	ofVec3f bounds_min, bounds_max;
+
+	// positions, the first colour and uv sets and the triangles
+	static void toMesh(const aiMesh* ai_mesh, ofMesh& mesh)
+	{
+		for (int i = 0; i < ai_mesh->mNumVertices; i++)
+		{
+			const aiVector3D& v = ai_mesh->mVertices[i];
+			mesh.addVertex(ofVec3f(v.x, v.y, v.z));
+		}
+
+		if (ai_mesh->HasVertexColors(0))
+		{
+			for (int i = 0; i < ai_mesh->mNumVertices; i++)
+			{
+				const aiColor4D& c = ai_mesh->mColors[0][i];
+				mesh.addColor(ofFloatColor(c.r, c.g, c.b, c.a));
+			}
+		}
+
+		if (ai_mesh->HasTextureCoords(0))
+		{
+			for (int i = 0; i < ai_mesh->mNumVertices; i++)
+			{
+				const aiVector3D& t = ai_mesh->mTextureCoords[0][i];
+				mesh.addTexCoord(ofVec2f(t.x, t.y));
+			}
+		}
+
+		for (int i = 0; i < ai_mesh->mNumFaces; i++)
+		{
+			const aiFace& face = ai_mesh->mFaces[i];
+			if (face.mNumIndices != 3) continue;
+
+			mesh.addIndex(face.mIndices[0]);
+			mesh.addIndex(face.mIndices[1]);
+			mesh.addIndex(face.mIndices[2]);
+		}
+	}
+
+	// of a material's diffuse texture, empty if there is none. relative
+	// names are relative to the obj file.
+	static string getTexturePath(const aiMaterial* material, const string& obj_path)
+	{
+		aiString file;
+		if (material->GetTexture(aiTextureType_DIFFUSE, 0, &file) != AI_SUCCESS) return "";
+
+		string name = file.data;
+		std::replace(name.begin(), name.end(), '\\', '/');
+		if (name.empty() || ofFilePath::isAbsolute(name)) return name;
+
+		return ofFilePath::join(ofFilePath::getEnclosingDirectory(obj_path, false), name);
+	}
+
+    // hits of one import face, in the order the serial loop produced them
+    struct VoxelHit {
+        int x, y, z;
+        ofColor color;
+    };
+    
+    enum { FACES_PER_BLOCK = 1024 };
+    
+    // the colour of one face at the point closest to a cell centre, from
+    // the texture when the mesh has one, else from the vertex colours
+    struct FaceColor {
+        ofVec3f p[3];
+        ofVec2f uv[3];
+        ofFloatColor colors[3];
+        bool has_uv, has_colors;
+        const ofPixels& pixels;
+        
+        FaceColor(const ofMesh& mesh, const ofPixels& pixels, int idx, const ofVec3f face_vertices[3]) : pixels(pixels) {
+            has_uv = pixels.isAllocated() && pixels.getWidth() > 0 && pixels.getHeight() > 0;
+            has_colors = mesh.hasColors();
+            
+            for (int k = 0; k < 3; k++) {
+                int i = mesh.getIndex(idx + k);
+                p[k] = face_vertices[k];
+                has_uv = has_uv && i < mesh.getNumTexCoords();
+                has_colors = has_colors && i < mesh.getNumColors();
+            }
+            for (int k = 0; k < 3; k++) {
+                int i = mesh.getIndex(idx + k);
+                if (has_uv) uv[k] = mesh.getTexCoord(i);
+                if (has_colors) colors[k] = mesh.getColor(i);
+            }
+        }
+        
+        ofColor at(const ofVec3f& q) const {
+            if (!has_uv && !has_colors) return ofColor();
+            
+            float w[3];
+            closestPoint(q, w);
+            
+            if (has_uv) {
+                // nearest texel, uvs outside [0, 1] repeat
+                ofVec2f t = uv[0] * w[0] + uv[1] * w[1] + uv[2] * w[2];
+                int tw = pixels.getWidth(), th = pixels.getHeight();
+                int tx = ofClamp((int)floor((t.x - floor(t.x)) * tw), 0, tw - 1);
+                int ty = ofClamp((int)floor((t.y - floor(t.y)) * th), 0, th - 1);
+                return pixels.getColor(tx, ty);
+            }
+            
+            ofFloatColor c;
+            c.r = colors[0].r * w[0] + colors[1].r * w[1] + colors[2].r * w[2];
+            c.g = colors[0].g * w[0] + colors[1].g * w[1] + colors[2].g * w[2];
+            c.b = colors[0].b * w[0] + colors[1].b * w[1] + colors[2].b * w[2];
+            c.a = colors[0].a * w[0] + colors[1].a * w[1] + colors[2].a * w[2];
+            return ofColor(ofClamp(c.r * 255 + 0.5f, 0, 255), ofClamp(c.g * 255 + 0.5f, 0, 255),
+                           ofClamp(c.b * 255 + 0.5f, 0, 255), ofClamp(c.a * 255 + 0.5f, 0, 255));
+        }
+        
+        // barycentric weights of the point of the face closest to q
+        // (ericson, real-time collision detection 5.1.5)
+        void closestPoint(const ofVec3f& q, float w[3]) const {
+            ofVec3f ab = p[1] - p[0], ac = p[2] - p[0], ap = q - p[0];
+            float d1 = ab.dot(ap), d2 = ac.dot(ap);
+            if (d1 <= 0 && d2 <= 0) { w[0] = 1; w[1] = 0; w[2] = 0; return; }
+            
+            ofVec3f bp = q - p[1];
+            float d3 = ab.dot(bp), d4 = ac.dot(bp);
+            if (d3 >= 0 && d4 <= d3) { w[0] = 0; w[1] = 1; w[2] = 0; return; }
+            
+            float vc = d1 * d4 - d3 * d2;
+            if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+                float v = d1 / (d1 - d3);
+                w[0] = 1 - v; w[1] = v; w[2] = 0;
+                return;
+            }
+            
+            ofVec3f cp = q - p[2];
+            float d5 = ab.dot(cp), d6 = ac.dot(cp);
+            if (d6 >= 0 && d5 <= d6) { w[0] = 0; w[1] = 0; w[2] = 1; return; }
+            
+            float vb = d5 * d2 - d1 * d6;
+            if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+                float v = d2 / (d2 - d6);
+                w[0] = 1 - v; w[1] = 0; w[2] = v;
+                return;
+            }
+            
+            float va = d3 * d6 - d5 * d4;
+            if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+                float v = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+                w[0] = 0; w[1] = 1 - v; w[2] = v;
+                return;
+            }
+            
+            // degenerate faces that got this far take the first vertex
+            float sum = va + vb + vc;
+            if (!(sum > 0)) { w[0] = 1; w[1] = 0; w[2] = 0; return; }
+            
+            w[1] = vb / sum;
+            w[2] = vc / sum;
+            w[0] = 1 - w[1] - w[2];
+        }
+    };
+    
+    // tested counts the cells an overlap test ran on. cells outside
+    // [0, grid_size) are skipped.
+    static void voxelizeFace(const ofMesh& mesh, const vector<ofVec3f>& vertices, const ofPixels& pixels,
+                             int idx, float min_x, float min_y, float min_z, float step, const int grid_size[3],
+                             vector<VoxelHit>& hits, size_t& tested) {
+        ofVec3f face_vertices[3] = {vertices[mesh.getIndex(idx)], vertices[mesh.getIndex(idx + 1)], vertices[mesh.getIndex(idx + 2)]};
+        
+        // Calculate the bounding box of face
+        float local_min_x = std::min(face_vertices[0].x, std::min(face_vertices[1].x, face_vertices[2].x));
+        float local_max_x = std::max(face_vertices[0].x, std::max(face_vertices[1].x, face_vertices[2].x));
+        float local_min_y = std::min(face_vertices[0].y, std::min(face_vertices[1].y, face_vertices[2].y));
+        float local_max_y = std::max(face_vertices[0].y, std::max(face_vertices[1].y, face_vertices[2].y));
+        float local_min_z = std::min(face_vertices[0].z, std::min(face_vertices[1].z, face_vertices[2].z));
+        float local_max_z = std::max(face_vertices[0].z, std::max(face_vertices[1].z, face_vertices[2].z));
+        
+        // Calculate the voxel coordination
+        int x_start = std::max<float>(floor((local_min_x - min_x) / step), 0);
+        int x_end = std::min<float>(ceil((local_max_x - min_x) / step), grid_size[0]);
+        int y_start = std::max<float>(floor((local_min_y - min_y) / step), 0);
+        int y_end = std::min<float>(ceil((local_max_y - min_y) / step), grid_size[1]);
+        int z_start = std::max<float>(floor((local_min_z - min_z) / step), 0);
+        int z_end = std::min<float>(ceil((local_max_z - min_z) / step), grid_size[2]);
+        
+        // Outside the import bounds
+        if (x_start >= x_end || y_start >= y_end || z_start >= z_end) return;
+        
+        FaceColor color(mesh, pixels, idx, face_vertices);
+        float half = step / 2;
+        
+        // Check all the voxels in the bounding box intersecting the face
+        float tri[3][3];
+        for (int k = 0; k < 3; k++) {
+            tri[k][0] = face_vertices[k].x;
+            tri[k][1] = face_vertices[k].y;
+            tri[k][2] = face_vertices[k].z;
+        }
+        
+        // large faces are set up once and rasterized, only cells along
+        // their footprint are tested
+        long bbox_cells = (long)(x_end - x_start) * (y_end - y_start) * (z_end - z_start);
+        if (bbox_cells >= VoxelTriCells::MIN_CELLS) {
+            float origin[3] = {min_x, min_y, min_z};
+            int lo[3] = {x_start, y_start, z_start};
+            int hi[3] = {x_end, y_end, z_end};
+            
+            VoxelTriCells cells(tri, origin, step);
+            cells.forEachCell(lo, hi, [&](int x, int y, int z) {
+                ofVec3f center((min_x + x * step) + half, (min_y + y * step) + half, (min_z + z * step) + half);
+                VoxelHit hit = {x, y, z, color.at(center)};
+                hits.push_back(hit);
+            });
+            tested += cells.getNumTested();
+            return;
+        }
+        
+        tested += bbox_cells;
+        
+        // small ones up to MAX_BOXES cells at a time
+        float cx[VoxelTriBox::MAX_BOXES], cy[VoxelTriBox::MAX_BOXES], cz[VoxelTriBox::MAX_BOXES];
+        int cells[VoxelTriBox::MAX_BOXES][3];
+        int n = 0;
+        
+        for (int x = x_start; x < x_end; x++)
+            for (int y = y_start; y < y_end; y++)
+                for (int z = z_start; z < z_end; z++) {
+                    cx[n] = (min_x + x * step) + half;
+                    cy[n] = (min_y + y * step) + half;
+                    cz[n] = (min_z + z * step) + half;
+                    cells[n][0] = x;
+                    cells[n][1] = y;
+                    cells[n][2] = z;
+                    
+                    if (++n == VoxelTriBox::MAX_BOXES) {
+                        addHits(tri, cx, cy, cz, half, cells, n, color, hits);
+                        n = 0;
+                    }
+                }
+        
+        if (n) addHits(tri, cx, cy, cz, half, cells, n, color, hits);
+    }
+    
+    static void addHits(const float tri[3][3], const float* cx, const float* cy, const float* cz, float half,
+                        const int cells[][3], int n, const FaceColor& color, vector<VoxelHit>& hits) {
+        uint32_t mask = VoxelTriBox::overlap(tri, cx, cy, cz, half, n);
+        for (int i = 0; mask; i++, mask >>= 1) {
+            if ((mask & 1) == 0) continue;
+            
+            VoxelHit hit = {cells[i][0], cells[i][1], cells[i][2], color.at(ofVec3f(cx[i], cy[i], cz[i]))};
+            hits.push_back(hit);
+        }
+    }
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// flat open addressing hash map from a cell coordinate to a voxel index.
+// keys are (x, y, z) packed into 21 bits each, probing is linear and
+// erase uses backward shift so the table never accumulates tombstones.
+class VoxelIndex
+{
+public:
+
+	VoxelIndex() : num_entries(0)
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		keys.assign(MIN_CAPACITY, uint64_t(EMPTY_KEY));
+		values.assign(MIN_CAPACITY, -1);
+		num_entries = 0;
+	}
+
+	void reserve(size_t n)
+	{
+		size_t capacity = keys.size();
+		while (n * 4 > capacity * 3) capacity *= 2;
+		if (capacity != keys.size()) rehash(capacity);
+	}
+
+	int find(int x, int y, int z) const
+	{
+		uint64_t key = pack(x, y, z);
+		size_t mask = keys.size() - 1;
+		size_t i = hash(key) & mask;
+
+		while (keys[i] != EMPTY_KEY)
+		{
+			if (keys[i] == key) return values[i];
+			i = (i + 1) & mask;
+		}
+
+		return -1;
+	}
+
+	void set(int x, int y, int z, int value)
+	{
+		if ((num_entries + 1) * 4 > keys.size() * 3)
+			rehash(keys.size() * 2);
+
+		insert(pack(x, y, z), value);
+	}
+
+	void erase(int x, int y, int z)
+	{
+		uint64_t key = pack(x, y, z);
+		size_t mask = keys.size() - 1;
+		size_t i = hash(key) & mask;
+
+		while (keys[i] != key)
+		{
+			if (keys[i] == EMPTY_KEY) return;
+			i = (i + 1) & mask;
+		}
+
+		// shift following entries of the same cluster back into the hole
+		size_t hole = i;
+		size_t j = i;
+
+		while (true)
+		{
+			j = (j + 1) & mask;
+			if (keys[j] == EMPTY_KEY) break;
+
+			size_t home = hash(keys[j]) & mask;
+			if (((j - home) & mask) >= ((j - hole) & mask))
+			{
+				keys[hole] = keys[j];
+				values[hole] = values[j];
+				hole = j;
+			}
+		}
+
+		keys[hole] = EMPTY_KEY;
+		values[hole] = -1;
+		num_entries--;
+	}
+
+	size_t size() const { return num_entries; }
+
+	// valid coordinate range per axis
+	static const int MIN_COORD = -(1 << 20);
+	static const int MAX_COORD = (1 << 20) - 1;
+
+	// whether every cell of a box is in range. keys of cells outside would
+	// alias cells inside, so they must not get here.
+	static bool contains(long long x, long long y, long long z, int w = 1, int h = 1, int d = 1)
+	{
+		return x >= MIN_COORD && x + std::max(w, 1) - 1 <= MAX_COORD
+			&& y >= MIN_COORD && y + std::max(h, 1) - 1 <= MAX_COORD
+			&& z >= MIN_COORD && z + std::max(d, 1) - 1 <= MAX_COORD;
+	}
+
+private:
+
+	enum { MIN_CAPACITY = 16 };
+	static const uint64_t EMPTY_KEY = ~(uint64_t)0;
+
+	vector<uint64_t> keys;
+	vector<int> values;
+	size_t num_entries;
+
+	static uint64_t pack(int x, int y, int z)
+	{
+		const uint64_t mask = (1 << 21) - 1;
+		return (((uint64_t)(x - MIN_COORD) & mask) << 42)
+			| (((uint64_t)(y - MIN_COORD) & mask) << 21)
+			| ((uint64_t)(z - MIN_COORD) & mask);
+	}
+
+	static size_t hash(uint64_t k)
+	{
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		return (size_t)k;
+	}
+
+	void insert(uint64_t key, int value)
+	{
+		size_t mask = keys.size() - 1;
+		size_t i = hash(key) & mask;
+
+		while (keys[i] != EMPTY_KEY)
+		{
+			if (keys[i] == key)
+			{
+				values[i] = value;
+				return;
+			}
+			i = (i + 1) & mask;
+		}
+
+		keys[i] = key;
+		values[i] = value;
+		num_entries++;
+	}
+
+	void rehash(size_t capacity)
+	{
+		vector<uint64_t> old_keys(capacity, uint64_t(EMPTY_KEY));
+		vector<int> old_values(capacity, -1);
+		old_keys.swap(keys);
+		old_values.swap(values);
+
+		num_entries = 0;
+
+		for (size_t i = 0; i < old_keys.size(); i++)
+		{
+			if (old_keys[i] != EMPTY_KEY)
+				insert(old_keys[i], old_values[i]);
+		}
+	}
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "VoxelData.h"
+
+// one entry per voxel in the instanced render path. position and size are
+// in grid cells, colour is normalized rgba bytes.
+struct VoxelInstance
+{
+	float x, y, z;
+	float w, h, d;
+	unsigned char r, g, b, a;
+};
+
+// packs every voxel of a model into a flat VoxelInstance array. plain cpu
+// code, nothing here touches GL, so it can be built and checked headless.
+class VoxelInstanceBuilder
+{
+public:
+
+	VoxelInstanceBuilder() : revision(0), built(false) {}
+
+	// returns true if the buffer was rebuilt
+	bool update(const Voxel& voxels)
+	{
+		if (built && revision == voxels.getRevision()) return false;
+
+		build(voxels);
+		return true;
+	}
+
+	void build(const Voxel& voxels)
+	{
+		instances.clear();
+		instances.reserve(voxels.size());
+
+		voxels.forEach([&](const VoxelData& v)
+		{
+			VoxelInstance o;
+			o.x = v.x;
+			o.y = v.y;
+			o.z = v.z;
+			o.w = v.w;
+			o.h = v.h;
+			o.d = v.d;
+			o.r = v.color.r;
+			o.g = v.color.g;
+			o.b = v.color.b;
+			o.a = 255;
+			instances.push_back(o);
+		});
+
+		revision = voxels.getRevision();
+		built = true;
+	}
+
+	void invalidate() { built = false; }
+
+	const vector<VoxelInstance>& getInstances() const { return instances; }
+	size_t size() const { return instances.size(); }
+
+private:
+
+	vector<VoxelInstance> instances;
+	unsigned int revision;
+	bool built;
+};
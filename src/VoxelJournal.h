@@ -0,0 +1,456 @@
+#pragma once
+
+#include "VoxelTask.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// autosave as an append-only log of edits on top of a snapshot. every
+// edit is one fixed size record, flushed once per operation and once per
+// frame, so the cost does not grow with the model. clearing the model is a
+// single record. now and then the journal is compacted:
+// the model is copied, a new journal is started and the copy is written as
+// the new snapshot on a worker thread.
+//
+// files in the journal folder, one generation per compaction:
+//
+//   snapshot-<n>.vxb  the model when journal n was started
+//   journal-<n>.bin   JournalHeader, then Record[]
+//
+// recovery loads the newest snapshot that can be read and replays its
+// journal and every later one, so a crash while a snapshot is written
+// falls back to the previous generation. a journal started after the
+// model was replaced (reset) ends the chain. voxels are found by
+// position, not id: ids are not kept by snapshots.
+
+class VoxelJournal
+{
+public:
+
+	enum
+	{
+		COMPACT_RECORDS = 1 << 16,       // start a new generation after this many edits
+		COMPACT_SECONDS = 5 * 60,        // or after this long with any edits
+	};
+
+	VoxelJournal() : fp(NULL), generation(0), num_records(0), last_compact(0), snapshot_generation(0) {}
+	~VoxelJournal() { close(); }
+
+	// the folder is created if needed, relative to the data folder
+	bool open(const string& dir)
+	{
+		close();
+		this->dir = ofToDataPath(dir);
+
+		if (!ofDirectory::doesDirectoryExist(this->dir, false)
+			&& !ofDirectory::createDirectory(this->dir, false, true))
+		{
+			ofLogError("VoxelJournal") << "can't create " << this->dir;
+			return false;
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		snapshot.cancel();
+		finishSnapshot(snapshot.wait());
+
+		if (fp) fclose(fp);
+		fp = NULL;
+	}
+
+	// rebuild the model from the newest snapshot that can be read and the
+	// journals after it, older snapshots are tried in turn. false if there
+	// was nothing to recover. files that can't be used are moved aside,
+	// never deleted.
+	bool recover(Voxel& voxels)
+	{
+		vector<int> snapshots, journals;
+		list(snapshots, journals);
+
+		for (int i = snapshots.size() - 1; i >= 0; i--)
+		{
+			int first = snapshots[i];
+
+			Voxel recovered;
+			if (!recovered.loadBinary(snapshotPath(first)))
+			{
+				ofLogError("VoxelJournal") << "recover(): can't read " << snapshotPath(first);
+				continue;
+			}
+
+			size_t replayed = 0;
+			int gen = first;
+			for (; std::binary_search(journals.begin(), journals.end(), gen); gen++)
+			{
+				if (!replay(journalPath(gen), recovered, replayed, gen != first)) break;
+			}
+
+			ofLogNotice("VoxelJournal") << "recover(): " << recovered.size() << " voxels from generation "
+				<< first << ", replayed " << replayed << " edits";
+
+			// the snapshots that failed and the journals past the chain
+			vector<string> unused;
+			for (int k = i + 1; k < snapshots.size(); k++) unused.push_back(snapshotPath(snapshots[k]));
+			for (int k = 0; k < journals.size(); k++)
+				if (journals[k] >= gen) unused.push_back(journalPath(journals[k]));
+			moveAside(unused);
+
+			voxels.swap(recovered);
+
+			// the next journal continues the chain, compact() keeps the old
+			// generations until the recovered model has a snapshot of its own
+			generation = std::max(gen - 1, generation);
+			return true;
+		}
+
+		vector<string> unused;
+		for (int k = 0; k < snapshots.size(); k++) unused.push_back(snapshotPath(snapshots[k]));
+		for (int k = 0; k < journals.size(); k++) unused.push_back(journalPath(journals[k]));
+		moveAside(unused);
+
+		return false;
+	}
+
+	// the model was replaced as a whole (load, import). edits in the old
+	// journals no longer apply, a new generation starts from a snapshot of
+	// its own without continuing them. the old files stay until that
+	// snapshot is written.
+	void reset(const Voxel& voxels)
+	{
+		snapshot.cancel();
+		finishSnapshot(snapshot.wait());
+
+		vector<int> snapshots, journals;
+		list(snapshots, journals);
+		if (!snapshots.empty()) generation = std::max(generation, snapshots.back());
+		if (!journals.empty()) generation = std::max(generation, journals.back());
+
+		begin(voxels, 0);
+	}
+
+	// from the main loop: picks up finished snapshots, compacts when due
+	void update(const Voxel& voxels)
+	{
+		VoxelTask::State state = snapshot.poll();
+		if (state == VoxelTask::RUNNING) return;
+		finishSnapshot(state);
+
+		flush();
+		if (fp == NULL || num_records == 0) return;
+
+		if (num_records >= COMPACT_RECORDS
+			|| ofGetElapsedTimef() - last_compact >= COMPACT_SECONDS)
+		{
+			compact(voxels);
+		}
+	}
+
+	// the same calls as VoxelHistory, with the voxel as it was / is now
+	void add(const VoxelData& after) { append(Record::ADD, after, after); }
+	void remove(const VoxelData& before) { append(Record::REMOVE, before, before); }
+	void update(const VoxelData& before, const VoxelData& after) { append(Record::UPDATE, before, after); }
+
+	// every voxel removed at once
+	void clear() { VoxelData none = VoxelData(); append(Record::CLEAR, none, none); }
+
+	// after each operation, so a crash of the editor loses at most the one
+	// in progress. no fsync.
+	void flush()
+	{
+		if (fp == NULL || fflush(fp) == 0) return;
+
+		ofLogError("VoxelJournal") << "can't append to " << journalPath(generation);
+		fclose(fp);
+		fp = NULL;
+	}
+
+	bool isOpen() const { return fp != NULL; }
+	int getGeneration() const { return generation; }
+	size_t getNumRecords() const { return num_records; }
+
+	// a new journal for the edits from here on, the copy becomes its
+	// snapshot. older generations stay until the snapshot is written.
+	void compact(const Voxel& voxels)
+	{
+		begin(voxels, JournalHeader::CONTINUES);
+	}
+
+private:
+
+	#pragma pack(push, 1)
+
+	// version 1 had no flags and always continued
+	struct JournalHeader
+	{
+		enum { CONTINUES = 1 };     // replays on top of the previous generation
+
+		char magic[4];
+		uint32_t version;
+		uint32_t record_size;
+		uint32_t flags;
+	};
+
+	// before is how to find the voxel, after what it becomes
+	struct Record
+	{
+		enum Type { ADD = 1, REMOVE, UPDATE, CLEAR };
+
+		int32_t type;
+		int32_t x, y, z, w, h, d;
+		uint32_t color;
+		int32_t nx, ny, nz, nw, nh, nd;
+		uint32_t ncolor;
+	};
+
+	#pragma pack(pop)
+
+	string dir;
+	FILE* fp;
+	int generation;
+	size_t num_records;
+	float last_compact;
+
+	VoxelTask snapshot;
+	int snapshot_generation;
+
+	string snapshotPath(int gen) const { return ofFilePath::join(dir, "snapshot-" + ofToString(gen) + ".vxb"); }
+	string journalPath(int gen) const { return ofFilePath::join(dir, "journal-" + ofToString(gen) + ".bin"); }
+
+	void begin(const Voxel& voxels, uint32_t flags)
+	{
+		if (snapshot.isRunning()) return;
+
+		if (fp) fclose(fp);
+		fp = NULL;
+
+		generation++;
+		num_records = 0;
+		last_compact = ofGetElapsedTimef();
+
+		string path = journalPath(generation);
+		fp = fopen(path.c_str(), "wb");
+		if (fp == NULL)
+		{
+			ofLogError("VoxelJournal") << "can't write " << path;
+			return;
+		}
+
+		JournalHeader header;
+		memcpy(header.magic, "VXJ", 4);
+		header.version = 2;
+		header.record_size = sizeof(Record);
+		header.flags = flags;
+		fwrite(&header, sizeof(header), 1, fp);
+		fflush(fp);
+
+		// written next to the target and renamed, a snapshot exists only
+		// once it is complete
+		string target = snapshotPath(generation);
+		snapshot_generation = generation;
+		snapshot.start("snapshot", [target](Voxel& v, const VoxelProgress& progress)
+		{
+			string part = target + ".part";
+			bool ok = v.saveBinary(part, progress);
+			if (ok) ok = ofFile::moveFromTo(part, target, false, true);
+			if (!ok) ofFile::removeFile(part, false);
+			return ok;
+		}, voxels);
+	}
+
+	void list(vector<int>& snapshots, vector<int>& journals) const
+	{
+		ofDirectory listing(dir);
+		listing.listDir();
+
+		for (int i = 0; i < listing.size(); i++)
+		{
+			string name = listing.getName(i);
+			int gen;
+
+			// exact names only, not the .part files
+			if (sscanf(name.c_str(), "snapshot-%d", &gen) == 1 && name == "snapshot-" + ofToString(gen) + ".vxb")
+				snapshots.push_back(gen);
+			else if (sscanf(name.c_str(), "journal-%d", &gen) == 1 && name == "journal-" + ofToString(gen) + ".bin")
+				journals.push_back(gen);
+		}
+
+		std::sort(snapshots.begin(), snapshots.end());
+		std::sort(journals.begin(), journals.end());
+	}
+
+	// into a folder of their own, out of the way of list(), so they can
+	// still be looked at by hand
+	void moveAside(const vector<string>& paths)
+	{
+		if (paths.empty()) return;
+
+		string aside = ofFilePath::join(dir, "unused-" + ofGetTimestampString());
+		if (!ofDirectory::doesDirectoryExist(aside, false)
+			&& !ofDirectory::createDirectory(aside, false, true))
+		{
+			ofLogError("VoxelJournal") << "can't create " << aside;
+			return;
+		}
+
+		for (int i = 0; i < paths.size(); i++)
+		{
+			string target = ofFilePath::join(aside, ofFilePath::getFileName(paths[i], false));
+			if (!ofFile::moveFromTo(paths[i], target, false, true))
+				ofLogError("VoxelJournal") << "can't move " << paths[i] << " to " << aside;
+		}
+
+		ofLogWarning("VoxelJournal") << "recover(): moved " << paths.size() << " files that could not be used to " << aside;
+	}
+
+	// older generations are dropped once a newer snapshot is on disk
+	void finishSnapshot(VoxelTask::State state)
+	{
+		if (state == VoxelTask::IDLE || state == VoxelTask::RUNNING) return;
+		snapshot.clearResult();
+
+		if (state != VoxelTask::DONE)
+		{
+			if (state == VoxelTask::FAILED)
+				ofLogError("VoxelJournal") << "can't write " << snapshotPath(snapshot_generation);
+			return;
+		}
+
+		vector<int> snapshots, journals;
+		list(snapshots, journals);
+		for (int i = 0; i < snapshots.size(); i++)
+			if (snapshots[i] < snapshot_generation) ofFile::removeFile(snapshotPath(snapshots[i]), false);
+		for (int i = 0; i < journals.size(); i++)
+			if (journals[i] < snapshot_generation) ofFile::removeFile(journalPath(journals[i]), false);
+	}
+
+	void append(Record::Type type, const VoxelData& before, const VoxelData& after)
+	{
+		if (fp == NULL) return;
+
+		Record r;
+		r.type = type;
+		r.x = before.x;
+		r.y = before.y;
+		r.z = before.z;
+		r.w = before.w;
+		r.h = before.h;
+		r.d = before.d;
+		r.color = before.color.getHex();
+		r.nx = after.x;
+		r.ny = after.y;
+		r.nz = after.z;
+		r.nw = after.w;
+		r.nh = after.h;
+		r.nd = after.d;
+		r.ncolor = after.color.getHex();
+
+		if (fwrite(&r, sizeof(r), 1, fp) != 1)
+		{
+			ofLogError("VoxelJournal") << "can't append to " << journalPath(generation);
+			fclose(fp);
+			fp = NULL;
+			return;
+		}
+
+		num_records++;
+	}
+
+	// a torn record at the end, from a crash mid write, is dropped. a
+	// journal that doesn't continue the chain is not replayed.
+	static bool replay(const string& path, Voxel& voxels, size_t& replayed, bool chained)
+	{
+		FILE* in = fopen(path.c_str(), "rb");
+		if (in == NULL) return false;
+
+		JournalHeader header;
+		header.flags = JournalHeader::CONTINUES;
+		if (fread(&header, offsetof(JournalHeader, flags), 1, in) != 1
+			|| memcmp(header.magic, "VXJ", 4) != 0
+			|| (header.version != 1 && header.version != 2)
+			|| (header.version == 2 && fread(&header.flags, sizeof(header.flags), 1, in) != 1)
+			|| header.record_size != sizeof(Record))
+		{
+			ofLogError("VoxelJournal") << "replay(): unsupported file: " << path;
+			fclose(in);
+			return false;
+		}
+
+		if (chained && (header.flags & JournalHeader::CONTINUES) == 0)
+		{
+			ofLogNotice("VoxelJournal") << "replay(): " << path << " starts from a model that was replaced";
+			fclose(in);
+			return false;
+		}
+
+		Record r;
+		while (fread(&r, sizeof(r), 1, in) == 1)
+		{
+			VoxelData after;
+			after.id = 0;
+			after.x = r.nx;
+			after.y = r.ny;
+			after.z = r.nz;
+			after.w = r.nw;
+			after.h = r.nh;
+			after.d = r.nd;
+			after.color = ofColor::fromHex(r.ncolor);
+
+			if (r.type == Record::ADD)
+			{
+				voxels.add(after);
+			}
+			else if (r.type == Record::CLEAR)
+			{
+				voxels.clear();
+			}
+			else
+			{
+				VoxelData v;
+				if (find(voxels, r, v))
+				{
+					if (r.type == Record::REMOVE) voxels.remove(v);
+					else if (r.type == Record::UPDATE) voxels.update(v, after);
+				}
+			}
+
+			replayed++;
+		}
+
+		fclose(in);
+		return true;
+	}
+
+	// the voxel with the record's origin, preferring one of the same size
+	// and colour where boxes overlap
+	static bool find(const Voxel& voxels, const Record& r, VoxelData& v)
+	{
+		VoxelRegion cell = { r.x, r.y, r.z, r.x + 1, r.y + 1, r.z + 1 };
+		vector<VoxelData> found;
+		voxels.query(cell, found);
+
+		int best = -1;
+		for (int i = 0; i < found.size(); i++)
+		{
+			const VoxelData& o = found[i];
+			if (o.x != r.x || o.y != r.y || o.z != r.z) continue;
+
+			if (o.w == r.w && o.h == r.h && o.d == r.d && (uint32_t)o.color.getHex() == r.color)
+			{
+				best = i;
+				break;
+			}
+			if (best < 0) best = i;
+		}
+
+		if (best < 0) return false;
+		v = found[best];
+		return true;
+	}
+
+	VoxelJournal(const VoxelJournal&);
+	VoxelJournal& operator=(const VoxelJournal&);
+};
@@ -0,0 +1,1010 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <utility>
+#include <unordered_map>
+
+// reader and writer for the json schemas.
+//
+// version 1, one object per voxel:
+//
+//   { "version": 1, "updatedAt": <int>, "metadata": <string>,
+//     "voxels": [ { "id", "x", "y", "z", "w", "h", "d", "color" }, ... ] }
+//
+// version 2, column arrays and a colour palette, in blocks of up to
+// BLOCK_VOXELS voxels:
+//
+//   { "version": 2, "updatedAt": <int>, "metadata": <string>,
+//     "blocks": [ { "palette": [ <color>, ... ],
+//                   "runs": { "x": [], "y": [], "z": [], "length": [], "color": [] },
+//                   "boxes": { "at": [], "x": [], "y": [], "z": [], "w": [], "h": [], "d": [],
+//                              "color": [] } }, ... ] }
+//
+// runs are unit voxels of one colour that follow each other along x in the
+// order they were written. their x, y and z are deltas from the previous
+// run of the block, so rows come out as small numbers and zeros. boxes are
+// the voxels bigger than one cell, in absolute coordinates, and at is where
+// each one goes among the block's voxels. colors index the block's palette.
+// voxels keep their order; ids are not stored, voxels get their position in
+// the file like vxb records.
+//
+// both versions stream both ways, the writer holds one block of voxels and
+// the reader the columns of one block. version 1 is what older readers
+// know, version 2 is opt-in. the reader
+// hands each voxel to a callback either way, unknown keys are skipped.
+
+class VoxelJsonWriter
+{
+public:
+
+	enum { BLOCK_VOXELS = 1 << 16 };
+
+	VoxelJsonWriter() : fp(NULL), num_voxels(0), num_blocks(0), failed(false), version(1) {}
+	~VoxelJsonWriter() { close(); }
+
+	bool open(const string& path)
+	{
+		fp = fopen(path.c_str(), "wb");
+		failed = (fp == NULL);
+		buffer.clear();
+		buffer.reserve(BUFFER_SIZE);
+		num_voxels = 0;
+		num_blocks = 0;
+		pending.clear();
+		return !failed;
+	}
+
+	void begin(int version, long long updated_at, const string& metadata)
+	{
+		this->version = version;
+		write("{\"version\":");
+		writeInt(version);
+		write(",\"updatedAt\":");
+		writeInt(updated_at);
+		write(",\"metadata\":");
+		writeString(metadata);
+	}
+
+	void beginVoxels()
+	{
+		write(version == 1 ? ",\"voxels\":[" : ",\"blocks\":[");
+	}
+
+	void voxel(int id, int x, int y, int z, int w, int h, int d, int color)
+	{
+		if (version != 1)
+		{
+			Box v = { x, y, z, w, h, d, color, 0 };
+			pending.push_back(v);
+			if (pending.size() >= BLOCK_VOXELS) writeBlock();
+			return;
+		}
+
+		if (num_voxels++ > 0) write(",");
+		write("{\"id\":"); writeInt(id);
+		write(",\"x\":"); writeInt(x);
+		write(",\"y\":"); writeInt(y);
+		write(",\"z\":"); writeInt(z);
+		write(",\"w\":"); writeInt(w);
+		write(",\"h\":"); writeInt(h);
+		write(",\"d\":"); writeInt(d);
+		write(",\"color\":"); writeInt(color);
+		write("}");
+	}
+
+	void endVoxels()
+	{
+		if (version != 1 && !pending.empty()) writeBlock();
+		write("]");
+	}
+
+	// returns false if anything failed since open()
+	bool close()
+	{
+		if (fp == NULL) return !failed;
+
+		write("}\n");
+		flush();
+		if (fclose(fp) != 0) failed = true;
+		fp = NULL;
+
+		return !failed;
+	}
+
+	// raw json text, for callers emitting their own keys
+	void write(const char* s)
+	{
+		while (*s) put(*s++);
+	}
+
+	void writeInt(long long v)
+	{
+		char tmp[24];
+		int n = 0;
+		bool neg = v < 0;
+		unsigned long long u = neg ? -(unsigned long long)v : v;
+
+		do
+		{
+			tmp[n++] = '0' + (u % 10);
+			u /= 10;
+		} while (u);
+
+		if (neg) put('-');
+		while (n) put(tmp[--n]);
+	}
+
+	void writeString(const string& s)
+	{
+		put('"');
+		for (int i = 0; i < s.size(); i++)
+		{
+			unsigned char c = s[i];
+			switch (c)
+			{
+				case '"': write("\\\""); break;
+				case '\\': write("\\\\"); break;
+				case '\n': write("\\n"); break;
+				case '\r': write("\\r"); break;
+				case '\t': write("\\t"); break;
+				default:
+					if (c < 0x20)
+					{
+						char tmp[8];
+						snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+						write(tmp);
+					}
+					else put(c);
+			}
+		}
+		put('"');
+	}
+
+private:
+
+	enum { BUFFER_SIZE = 1 << 16 };
+
+	struct Box
+	{
+		int x, y, z;
+		int w, h, d;
+		int color;
+		int at;
+	};
+
+	struct Run
+	{
+		int x, y, z;
+		int length;
+		int color;
+	};
+
+	FILE* fp;
+	string buffer;
+	size_t num_voxels, num_blocks;
+	bool failed;
+	int version;
+
+	// the block being collected and the columns it becomes, kept between
+	// blocks for their memory
+	vector<Box> pending, boxes;
+	vector<Run> runs;
+	vector<int> palette;
+	std::unordered_map<int, int> palette_index;
+
+	// the pending voxels as one block, in their order. a unit voxel right
+	// after the end of the last run along x extends it, boxes in between
+	// don't break it since they keep their own position.
+	void writeBlock()
+	{
+		palette.clear();
+		palette_index.clear();
+		runs.clear();
+		boxes.clear();
+
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			Box v = pending[i];
+
+			std::unordered_map<int, int>::iterator it = palette_index.find(v.color);
+			if (it == palette_index.end())
+			{
+				it = palette_index.insert(std::make_pair(v.color, (int)palette.size())).first;
+				palette.push_back(v.color);
+			}
+			v.color = it->second;
+
+			if (v.w != 1 || v.h != 1 || v.d != 1)
+			{
+				v.at = i;
+				boxes.push_back(v);
+				continue;
+			}
+
+			if (!runs.empty())
+			{
+				Run& last = runs.back();
+				if (last.z == v.z && last.y == v.y && last.color == v.color
+					&& (long long)last.x + last.length == v.x)
+				{
+					last.length++;
+					continue;
+				}
+			}
+
+			Run r = { v.x, v.y, v.z, 1, v.color };
+			runs.push_back(r);
+		}
+
+		pending.clear();
+
+		if (num_blocks++ > 0) write(",");
+		write("{\"palette\":[");
+		for (size_t i = 0; i < palette.size(); i++)
+		{
+			if (i > 0) put(',');
+			writeInt(palette[i]);
+		}
+		write("]");
+
+		write(",\"runs\":{\"x\":[");
+		writeDeltas(runs, &Run::x);
+		write("],\"y\":[");
+		writeDeltas(runs, &Run::y);
+		write("],\"z\":[");
+		writeDeltas(runs, &Run::z);
+		write("],\"length\":[");
+		writeColumn(runs, &Run::length);
+		write("],\"color\":[");
+		writeColumn(runs, &Run::color);
+		write("]}");
+
+		write(",\"boxes\":{\"at\":[");
+		writeColumn(boxes, &Box::at);
+		write("],\"x\":[");
+		writeColumn(boxes, &Box::x);
+		write("],\"y\":[");
+		writeColumn(boxes, &Box::y);
+		write("],\"z\":[");
+		writeColumn(boxes, &Box::z);
+		write("],\"w\":[");
+		writeColumn(boxes, &Box::w);
+		write("],\"h\":[");
+		writeColumn(boxes, &Box::h);
+		write("],\"d\":[");
+		writeColumn(boxes, &Box::d);
+		write("],\"color\":[");
+		writeColumn(boxes, &Box::color);
+		write("]}}");
+	}
+
+	template <typename T>
+	void writeColumn(const vector<T>& rows, int T::*field)
+	{
+		for (size_t i = 0; i < rows.size(); i++)
+		{
+			if (i > 0) put(',');
+			writeInt(rows[i].*field);
+		}
+	}
+
+	template <typename T>
+	void writeDeltas(const vector<T>& rows, int T::*field)
+	{
+		long long prev = 0;
+		for (size_t i = 0; i < rows.size(); i++)
+		{
+			if (i > 0) put(',');
+			writeInt(rows[i].*field - prev);
+			prev = rows[i].*field;
+		}
+	}
+
+	void put(char c)
+	{
+		buffer += c;
+		if (buffer.size() >= BUFFER_SIZE) flush();
+	}
+
+	void flush()
+	{
+		if (fp && !buffer.empty())
+		{
+			if (fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size())
+				failed = true;
+		}
+		buffer.clear();
+	}
+
+	VoxelJsonWriter(const VoxelJsonWriter&);
+	VoxelJsonWriter& operator=(const VoxelJsonWriter&);
+};
+
+class VoxelJsonReader
+{
+public:
+
+	struct Header
+	{
+		int version;
+		long long updated_at;
+		string metadata;
+
+		Header() : version(-1), updated_at(0) {}
+	};
+
+	struct Record
+	{
+		int id;
+		int x, y, z;
+		int w, h, d;
+		int color;
+		bool has_color;
+	};
+
+	VoxelJsonReader() : fp(NULL), pos(0), len(0), offset(0), file_size(0), stopped(false) {}
+	~VoxelJsonReader() { close(); }
+
+	bool open(const string& path)
+	{
+		close();
+		fp = fopen(path.c_str(), "rb");
+		buffer.resize(BUFFER_SIZE);
+		pos = len = 0;
+		offset = file_size = 0;
+		stopped = false;
+
+		if (fp && fseek(fp, 0, SEEK_END) == 0)
+		{
+			long n = ftell(fp);
+			if (n > 0) file_size = n;
+			fseek(fp, 0, SEEK_SET);
+		}
+
+		return fp != NULL;
+	}
+
+	void close()
+	{
+		if (fp) fclose(fp);
+		fp = NULL;
+	}
+
+	// ends the input where it is, read() then fails. safe from the callbacks
+	void stop()
+	{
+		close();
+		pos = len = 0;
+		stopped = true;
+	}
+
+	// bytes consumed so far, for progress
+	size_t getPosition() const { return offset - len + pos; }
+	size_t getSize() const { return file_size; }
+
+	// on_header(const Header&) runs before the first voxel and may return
+	// false to stop, e.g. on a version it does not know. on_voxel(const
+	// Record&) runs once per voxel. keys may come in any order: voxels
+	// stream when "version" comes before "voxels" (as written here) and are
+	// held until the end otherwise, version 2 blocks the same way. getHeader()
+	// has every key once read() returns.
+	template <typename H, typename F>
+	bool read(H on_header, F on_voxel)
+	{
+		header = Header();
+		bool version_seen = false;
+		bool header_sent = false;
+		vector<Record> held;
+		int next_id = 0;
+
+		skipWs();
+		if (!expect('{')) return false;
+
+		skipWs();
+		if (peek() == '}')
+		{
+			get();
+			return on_header(header);
+		}
+
+		while (true)
+		{
+			string key;
+			skipWs();
+			if (!readString(key)) return false;
+			skipWs();
+			if (!expect(':')) return false;
+			skipWs();
+
+			if (key == "version")
+			{
+				double v;
+				if (!readNumber(v) || !toInt(v, header.version)) return false;
+				version_seen = true;
+			}
+			else if (key == "updatedAt")
+			{
+				double v;
+				if (!readNumber(v) || !(v >= -9.2e18 && v <= 9.2e18) || v != floor(v)) return false;
+				header.updated_at = v;
+			}
+			else if (key == "metadata" && peek() == '"')
+			{
+				if (!readString(header.metadata)) return false;
+			}
+			else if ((key == "voxels" || key == "blocks") && (version_seen || header_sent))
+			{
+				if (!header_sent)
+				{
+					header_sent = true;
+					if (!on_header(header)) return false;
+				}
+				if (key == "voxels" ? !readVoxels(on_voxel) : !readBlocks(on_voxel, next_id)) return false;
+			}
+			else if (key == "voxels" || key == "blocks")
+			{
+				auto hold = [&](const Record& v) { held.push_back(v); };
+				if (key == "voxels" ? !readVoxels(hold) : !readBlocks(hold, next_id)) return false;
+			}
+			else if (!skipValue())
+			{
+				return false;
+			}
+
+			skipWs();
+			int c = get();
+			if (c == '}') break;
+			if (c != ',') return false;
+		}
+
+		if (!header_sent && !on_header(header)) return false;
+
+		for (size_t i = 0; i < held.size() && !stopped; i++) on_voxel(held[i]);
+		return !stopped;
+	}
+
+	const Header& getHeader() const { return header; }
+
+	// generic pieces, for other schemas built on the same tokenizer
+
+	bool readInt(int& v)
+	{
+		int c = peek();
+		bool neg = c == '-';
+		if (neg) get();
+
+		// one past INT_MAX is allowed for INT_MIN
+		const long long limit = (long long)INT_MAX + (neg ? 1 : 0);
+
+		long long n = 0;
+		int digits = 0;
+		while (true)
+		{
+			c = peek();
+			if (c < '0' || c > '9') break;
+			n = n * 10 + (get() - '0');
+			if (n > limit) return false;
+			digits++;
+		}
+
+		if (digits == 0 || c == '.' || c == 'e' || c == 'E') return false;
+
+		v = neg ? -n : n;
+		return true;
+	}
+
+	// numbers outside the int range or with a fraction are an error, not
+	// a wrap around or a truncation
+	static bool toInt(double n, int& v)
+	{
+		if (!(n >= INT_MIN && n <= INT_MAX) || n != floor(n)) return false;
+		v = n;
+		return true;
+	}
+
+	bool readInts(vector<int>& values)
+	{
+		values.clear();
+		if (!expect('[')) return false;
+
+		skipWs();
+		if (peek() == ']')
+		{
+			get();
+			return true;
+		}
+
+		while (true)
+		{
+			int v;
+			skipWs();
+			if (!readInt(v)) return false;
+			values.push_back(v);
+
+			skipWs();
+			int c = get();
+			if (c == ']') return true;
+			if (c != ',') return false;
+		}
+	}
+
+	void skipWs()
+	{
+		while (true)
+		{
+			int c = peek();
+			if (c == ' ' || c == '\t' || c == '\n' || c == '\r') get();
+			else break;
+		}
+	}
+
+	bool expect(char ch)
+	{
+		return get() == ch;
+	}
+
+	int peek()
+	{
+		if (pos == len && !fill()) return EOF;
+		return (unsigned char)buffer[pos];
+	}
+
+	int get()
+	{
+		if (pos == len && !fill()) return EOF;
+		return (unsigned char)buffer[pos++];
+	}
+
+	bool readNumber(double& v)
+	{
+		char tmp[64];
+		int n = 0;
+
+		while (n < (int)sizeof(tmp) - 1)
+		{
+			int c = peek();
+			if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')
+				tmp[n++] = get();
+			else break;
+		}
+
+		if (n == 0) return false;
+		tmp[n] = '\0';
+
+		char* end;
+		v = strtod(tmp, &end);
+		return end == tmp + n;
+	}
+
+	bool readString(string& s)
+	{
+		if (!expect('"')) return false;
+		s.clear();
+
+		while (true)
+		{
+			int c = get();
+			if (c == EOF) return false;
+			if (c == '"') return true;
+
+			if (c == '\\')
+			{
+				c = get();
+				switch (c)
+				{
+					case 'n': s += '\n'; break;
+					case 'r': s += '\r'; break;
+					case 't': s += '\t'; break;
+					case 'b': s += '\b'; break;
+					case 'f': s += '\f'; break;
+					case 'u':
+					{
+						char hex[5] = { 0 };
+						for (int i = 0; i < 4; i++) hex[i] = get();
+						appendUtf8(s, strtol(hex, NULL, 16));
+						break;
+					}
+					case EOF: return false;
+					default: s += (char)c; break;
+				}
+			}
+			else s += (char)c;
+		}
+	}
+
+	bool skipValue()
+	{
+		skipWs();
+		int c = peek();
+
+		if (c == '"')
+		{
+			string tmp;
+			return readString(tmp);
+		}
+
+		if (c == '{' || c == '[')
+		{
+			// strings are the only place brackets can hide
+			int depth = 0;
+			do
+			{
+				c = peek();
+				if (c == EOF) return false;
+				if (c == '"')
+				{
+					string tmp;
+					if (!readString(tmp)) return false;
+					continue;
+				}
+				get();
+				if (c == '{' || c == '[') depth++;
+				else if (c == '}' || c == ']') depth--;
+			} while (depth > 0);
+			return true;
+		}
+
+		// number, true, false, null
+		int n = 0;
+		while (true)
+		{
+			c = peek();
+			if (c == EOF || c == ',' || c == '}' || c == ']'
+				|| c == ' ' || c == '\t' || c == '\n' || c == '\r') break;
+			get();
+			n++;
+		}
+		return n > 0;
+	}
+
+private:
+
+	enum { BUFFER_SIZE = 1 << 16 };
+
+	FILE* fp;
+	vector<char> buffer;
+	size_t pos, len;
+	size_t offset, file_size;
+	bool stopped;
+	Header header;
+
+	typedef std::unordered_map<string, vector<int> > Table;
+
+	struct Columns
+	{
+		vector<int> palette;
+		Table runs, boxes;
+
+		void clear()
+		{
+			palette.clear();
+			runs.clear();
+			boxes.clear();
+		}
+
+		// boxes go in at their "at" position among the block's voxels,
+		// which has to be increasing and inside the block
+		template <typename F>
+		bool emit(F& on_voxel, int& id, const bool& stopped)
+		{
+			const vector<int>* box[8];
+			size_t num_boxes = 0;
+			if (!boxes.empty())
+			{
+				const char* keys[] = { "x", "y", "z", "w", "h", "d", "color", "at" };
+				if (!lookup(boxes, keys, box, 8)) return false;
+				num_boxes = box[0]->size();
+			}
+
+			const vector<int>* run[5];
+			size_t num_runs = 0;
+			if (!runs.empty())
+			{
+				const char* keys[] = { "x", "y", "z", "length", "color" };
+				if (!lookup(runs, keys, run, 5)) return false;
+				num_runs = run[0]->size();
+			}
+
+			size_t b = 0;
+			long long n = 0;  // voxels of the block handed out so far
+
+			auto emitBoxes = [&]() -> bool
+			{
+				while (b < num_boxes && (*box[7])[b] == n)
+				{
+					Record v;
+					v.id = id++;
+					v.x = (*box[0])[b];
+					v.y = (*box[1])[b];
+					v.z = (*box[2])[b];
+					v.w = (*box[3])[b];
+					v.h = (*box[4])[b];
+					v.d = (*box[5])[b];
+					if (!color((*box[6])[b], v)) return false;
+					on_voxel(v);
+					if (stopped) return false;
+					b++;
+					n++;
+				}
+				return true;
+			};
+
+			if (!emitBoxes()) return false;
+
+			long long x = 0, y = 0, z = 0;
+			for (size_t i = 0; i < num_runs; i++)
+			{
+				x += (*run[0])[i];
+				y += (*run[1])[i];
+				z += (*run[2])[i];
+
+				int len = (*run[3])[i];
+				if (len < 1) return false;
+				if (x < INT_MIN || x + len - 1 > INT_MAX) return false;
+				if (y < INT_MIN || y > INT_MAX || z < INT_MIN || z > INT_MAX) return false;
+
+				Record v;
+				v.y = y;
+				v.z = z;
+				v.w = v.h = v.d = 1;
+				if (!color((*run[4])[i], v)) return false;
+
+				for (int k = 0; k < len; k++)
+				{
+					v.id = id++;
+					v.x = x + k;
+					on_voxel(v);
+					n++;
+					if (!emitBoxes()) return false;
+				}
+				if (stopped) return false;
+			}
+
+			// an "at" past the end or out of order leaves boxes over
+			return b == num_boxes;
+		}
+
+		// every column present and of the same length
+		static bool lookup(const Table& table, const char** keys, const vector<int>** col, int n)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				Table::const_iterator it = table.find(keys[i]);
+				if (it == table.end()) return false;
+				col[i] = &it->second;
+				if (col[i]->size() != col[0]->size()) return false;
+			}
+			return true;
+		}
+
+		bool color(int i, Record& v) const
+		{
+			if (i < 0 || i >= (int)palette.size()) return false;
+			v.color = palette[i];
+			v.has_color = true;
+			return true;
+		}
+	};
+
+	// [ { "palette", "runs", "boxes" }, ... ], handed out a block at a time
+	template <typename F>
+	bool readBlocks(F& on_voxel, int& id)
+	{
+		if (!expect('[')) return false;
+
+		skipWs();
+		if (peek() == ']')
+		{
+			get();
+			return true;
+		}
+
+		Columns block;
+
+		while (true)
+		{
+			skipWs();
+			if (!readBlock(block) || !block.emit(on_voxel, id, stopped)) return false;
+
+			skipWs();
+			int c = get();
+			if (c == ']') return true;
+			if (c != ',') return false;
+		}
+	}
+
+	bool readBlock(Columns& block)
+	{
+		block.clear();
+		if (!expect('{')) return false;
+
+		skipWs();
+		if (peek() == '}')
+		{
+			get();
+			return true;
+		}
+
+		string key;
+
+		while (true)
+		{
+			skipWs();
+			if (!readString(key)) return false;
+			skipWs();
+			if (!expect(':')) return false;
+			skipWs();
+
+			if (key == "palette")
+			{
+				if (!readInts(block.palette)) return false;
+			}
+			else if (key == "runs" || key == "boxes")
+			{
+				if (!readColumns(key == "runs" ? block.runs : block.boxes)) return false;
+			}
+			else if (!skipValue())
+			{
+				return false;
+			}
+
+			skipWs();
+			int c = get();
+			if (c == '}') return true;
+			if (c != ',') return false;
+		}
+	}
+
+	// { "key": [ ints ], ... }, other values are skipped
+	bool readColumns(Table& table)
+	{
+		table.clear();
+		if (!expect('{')) return false;
+
+		skipWs();
+		if (peek() == '}')
+		{
+			get();
+			return true;
+		}
+
+		string key;
+
+		while (true)
+		{
+			skipWs();
+			if (!readString(key)) return false;
+			skipWs();
+			if (!expect(':')) return false;
+			skipWs();
+
+			if (peek() == '[')
+			{
+				if (!readInts(table[key])) return false;
+			}
+			else if (!skipValue())
+			{
+				return false;
+			}
+
+			skipWs();
+			int c = get();
+			if (c == '}') return true;
+			if (c != ',') return false;
+		}
+	}
+
+	bool fill()
+	{
+		if (fp == NULL) return false;
+		len = fread(&buffer[0], 1, buffer.size(), fp);
+		offset += len;
+		pos = 0;
+		return len > 0;
+	}
+
+	static void appendUtf8(string& s, long cp)
+	{
+		if (cp < 0x80) s += (char)cp;
+		else if (cp < 0x800)
+		{
+			s += (char)(0xc0 | (cp >> 6));
+			s += (char)(0x80 | (cp & 0x3f));
+		}
+		else
+		{
+			s += (char)(0xe0 | (cp >> 12));
+			s += (char)(0x80 | ((cp >> 6) & 0x3f));
+			s += (char)(0x80 | (cp & 0x3f));
+		}
+	}
+
+	template <typename F>
+	bool readVoxels(F& on_voxel)
+	{
+		if (!expect('[')) return false;
+
+		skipWs();
+		if (peek() == ']')
+		{
+			get();
+			return true;
+		}
+
+		string key;
+
+		while (true)
+		{
+			skipWs();
+			if (!expect('{')) return false;
+
+			Record v;
+			v.id = 0;
+			v.x = v.y = v.z = 0;
+			v.w = v.h = v.d = 0;
+			v.color = 0;
+			v.has_color = false;
+
+			skipWs();
+			if (peek() == '}') get();
+			else while (true)
+			{
+				skipWs();
+				if (!readString(key)) return false;
+				skipWs();
+				if (!expect(':')) return false;
+				skipWs();
+
+				int* field = NULL;
+
+				if (key.size() == 1)
+				{
+					switch (key[0])
+					{
+						case 'x': field = &v.x; break;
+						case 'y': field = &v.y; break;
+						case 'z': field = &v.z; break;
+						case 'w': field = &v.w; break;
+						case 'h': field = &v.h; break;
+						case 'd': field = &v.d; break;
+					}
+				}
+				else if (key == "id") field = &v.id;
+				else if (key == "color")
+				{
+					field = &v.color;
+					v.has_color = true;
+				}
+
+				if (field)
+				{
+					double n;
+					if (!readNumber(n) || !toInt(n, *field)) return false;
+				}
+				else if (!skipValue())
+				{
+					return false;
+				}
+
+				skipWs();
+				int c = get();
+				if (c == '}') break;
+				if (c != ',') return false;
+			}
+
+			on_voxel(v);
+
+			skipWs();
+			int c = get();
+			if (c == ']') return true;
+			if (c != ',') return false;
+		}
+	}
+
+	VoxelJsonReader(const VoxelJsonReader&);
+	VoxelJsonReader& operator=(const VoxelJsonReader&);
+};
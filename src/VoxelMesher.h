@@ -0,0 +1,264 @@
+#pragma once
+
+#include "VoxelData.h"
+
+struct VoxelMeshStats
+{
+	size_t num_voxels;
+	size_t num_quads;
+	size_t num_triangles;
+	size_t box_triangles; // what drawing a 12 triangle box per voxel costs
+	float build_ms;
+	size_t num_chunks;
+	size_t chunks_built; // chunks remeshed by the last update
+	int level; // cells are 2^level voxels wide
+
+	VoxelMeshStats() : num_voxels(0), num_quads(0), num_triangles(0), box_triangles(0), build_ms(0),
+		num_chunks(0), chunks_built(0), level(0) {}
+};
+
+// builds an indexed triangle mesh of the visible surface. every cell of every
+// voxel is rasterized into a VoxelChunkStore, faces between two solid cells
+// are dropped and coplanar faces of the same colour are merged greedily into
+// rectangles, one 16x16 slice at a time. at a level above 0 the grid is
+// downsampled to one cell per 2^level cube and that is meshed instead, for
+// drawing the model from far away.
+class VoxelMesher
+{
+public:
+
+	VoxelMesher() : level(0) {}
+
+	// takes effect with the next setVoxels()
+	void setLevel(int l) { level = l; }
+	int getLevel() const { return level; }
+
+	void build(const Voxel& voxels, ofMesh& mesh)
+	{
+		unsigned long long start = ofGetElapsedTimeMicros();
+
+		setVoxels(voxels);
+
+		mesh.clear();
+		mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+
+		const vector<VoxelChunk>& chunks = getGrid().getChunks();
+		for (int i = 0; i < chunks.size(); i++)
+			buildChunk(chunks[i], mesh);
+
+		stats.num_triangles = stats.num_quads * 2;
+		stats.build_ms = (ofGetElapsedTimeMicros() - start) / 1000.0;
+	}
+
+	// rasterizes the whole model into the grid, without meshing it. a cell
+	// covered twice takes the colour find() gives, like updateRegion() does.
+	void setVoxels(const Voxel& voxels)
+	{
+		grid.clear();
+		stats = VoxelMeshStats();
+
+		VoxelData shared;
+		voxels.forEach([&](const VoxelData& v)
+		{
+			for (int z = v.z; z < v.z + v.d; z++)
+				for (int y = v.y; y < v.y + v.h; y++)
+					for (int x = v.x; x < v.x + v.w; x++)
+					{
+						if (grid.has(x, y, z) && voxels.find(x, y, z, shared)) grid.set(x, y, z, shared.color);
+						else grid.set(x, y, z, v.color);
+					}
+
+			stats.box_triangles += 12;
+		});
+
+		if (level > 0) coarse.downsample(grid, level);
+
+		stats.num_voxels = grid.size();
+		stats.level = level;
+	}
+
+	// resamples the cells of a region from the model after an edit. chunks
+	// touching the region (plus one cell, for the faces of the neighbours)
+	// need buildChunk() again afterwards, see getRegion() for the cells
+	// that changed at the current level.
+	void updateRegion(const Voxel& voxels, const VoxelRegion& r)
+	{
+		VoxelData v;
+		for (int z = r.z0; z < r.z1; z++)
+			for (int y = r.y0; y < r.y1; y++)
+				for (int x = r.x0; x < r.x1; x++)
+				{
+					if (voxels.find(x, y, z, v)) grid.set(x, y, z, v.color);
+					else grid.erase(x, y, z);
+				}
+
+		if (level > 0)
+		{
+			VoxelRegion c = getRegion(r);
+			coarse.resample(grid, level, c.x0, c.y0, c.z0, c.x1, c.y1, c.z1);
+		}
+
+		stats.num_voxels = grid.size();
+	}
+
+	// the cells at the current level that cover a region of voxels
+	VoxelRegion getRegion(const VoxelRegion& r) const
+	{
+		VoxelRegion c;
+		c.x0 = r.x0 >> level;
+		c.y0 = r.y0 >> level;
+		c.z0 = r.z0 >> level;
+		c.x1 = ((r.x1 - 1) >> level) + 1;
+		c.y1 = ((r.y1 - 1) >> level) + 1;
+		c.z1 = ((r.z1 - 1) >> level) + 1;
+		return c;
+	}
+
+	// faces of one chunk only; neighbours are looked up in the store
+	void buildChunk(const VoxelChunk& chunk, ofMesh& mesh)
+	{
+		if (chunk.num_voxels == 0) return;
+
+		const int N = VoxelChunk::SIZE;
+		int origin[3] = { chunk.cx * N, chunk.cy * N, chunk.cz * N };
+		int scale = 1 << level;
+		int mask[N * N];
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+
+			for (int dir = -1; dir <= 1; dir += 2)
+			{
+				int nc[3] = { chunk.cx, chunk.cy, chunk.cz };
+				nc[axis] += dir;
+				const VoxelChunk* neighbour = getGrid().findChunk(nc[0], nc[1], nc[2]);
+
+				for (int k = 0; k < N; k++)
+				{
+					// faces of slice k that look into empty space
+					for (int j = 0; j < N; j++)
+						for (int i = 0; i < N; i++)
+						{
+							int p[3];
+							p[axis] = k;
+							p[u] = i;
+							p[v] = j;
+
+							int idx = chunk.getPaletteIndex(p[0], p[1], p[2]);
+							if (idx != 0)
+							{
+								p[axis] += dir;
+								if (p[axis] >= 0 && p[axis] < N)
+								{
+									if (chunk.has(p[0], p[1], p[2])) idx = 0;
+								}
+								else if (neighbour)
+								{
+									p[axis] &= N - 1;
+									if (neighbour->has(p[0], p[1], p[2])) idx = 0;
+								}
+							}
+
+							mask[j * N + i] = idx;
+						}
+
+					// merge into rectangles
+					for (int j = 0; j < N; j++)
+						for (int i = 0; i < N; )
+						{
+							int idx = mask[j * N + i];
+							if (idx == 0)
+							{
+								i++;
+								continue;
+							}
+
+							int w = 1;
+							while (i + w < N && mask[j * N + i + w] == idx) w++;
+
+							int h = 1;
+							while (j + h < N)
+							{
+								bool row = true;
+								for (int m = 0; m < w; m++)
+								{
+									if (mask[(j + h) * N + i + m] != idx)
+									{
+										row = false;
+										break;
+									}
+								}
+								if (!row) break;
+								h++;
+							}
+
+							for (int n = 0; n < h; n++)
+								for (int m = 0; m < w; m++)
+									mask[(j + n) * N + i + m] = 0;
+
+							float base[3];
+							base[axis] = (origin[axis] + k + (dir > 0 ? 1 : 0)) * scale;
+							base[u] = (origin[u] + i) * scale;
+							base[v] = (origin[v] + j) * scale;
+
+							addQuad(mesh, base, axis, u, v, w * scale, h * scale, dir, chunk.getPaletteColor(idx));
+
+							i += w;
+						}
+				}
+			}
+		}
+	}
+
+	const VoxelMeshStats& getStats() const { return stats; }
+
+	// the cells that get meshed, one per voxel at level 0
+	const VoxelChunkStore& getGrid() const { return level > 0 ? coarse : grid; }
+
+private:
+
+	VoxelChunkStore grid;
+	VoxelChunkStore coarse;
+	int level;
+	VoxelMeshStats stats;
+
+	void addQuad(ofMesh& mesh, const float base[3], int axis, int u, int v,
+				 int w, int h, int dir, const ofColor& color)
+	{
+		ofVec3f p0(base[0], base[1], base[2]);
+		ofVec3f du, dv, n;
+		du[u] = w;
+		dv[v] = h;
+		n[axis] = dir;
+
+		ofIndexType first = mesh.getNumVertices();
+
+		mesh.addVertex(p0);
+		mesh.addVertex(p0 + du);
+		mesh.addVertex(p0 + du + dv);
+		mesh.addVertex(p0 + dv);
+
+		ofFloatColor c(color.r / 255.0, color.g / 255.0, color.b / 255.0);
+		for (int i = 0; i < 4; i++)
+		{
+			mesh.addNormal(n);
+			mesh.addColor(c);
+		}
+
+		// u x v points along +axis, flip the winding for the negative side
+		if (dir > 0)
+		{
+			mesh.addIndex(first + 0); mesh.addIndex(first + 1); mesh.addIndex(first + 2);
+			mesh.addIndex(first + 0); mesh.addIndex(first + 2); mesh.addIndex(first + 3);
+		}
+		else
+		{
+			mesh.addIndex(first + 0); mesh.addIndex(first + 2); mesh.addIndex(first + 1);
+			mesh.addIndex(first + 0); mesh.addIndex(first + 3); mesh.addIndex(first + 2);
+		}
+
+		stats.num_quads++;
+	}
+};
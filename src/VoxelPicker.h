@@ -0,0 +1,50 @@
+#pragma once
+
+#include "VoxelData.h"
+
+#include <float.h>
+
+struct VoxelPick
+{
+	VoxelData voxel;  // a copy, unit voxels come with id -1
+	int x, y, z;      // cell the ray hit
+	ofVec3f normal;   // face it came in through, zero if it started inside
+	float t;          // distance along the (normalized) ray
+
+	VoxelPick() : x(0), y(0), z(0), t(0) {}
+};
+
+// analytic picking in grid space. pick() casts the ray through the
+// model's BVH for boxes and steps through the chunks for packed voxels, so
+// its cost follows what the ray passes rather than the empty cells it
+// crosses. see Voxel::raycast.
+class VoxelPicker
+{
+public:
+
+	bool pick(const Voxel& voxels, const ofVec3f& origin, const ofVec3f& dir, VoxelPick& hit)
+	{
+		int cell[3];
+		if (!voxels.raycast(origin, dir, hit.t, hit.normal, hit.voxel, cell)) return false;
+
+		hit.x = cell[0];
+		hit.y = cell[1];
+		hit.z = cell[2];
+		return true;
+	}
+
+	static bool intersectSphere(const ofVec3f& origin, const ofVec3f& dir,
+								const ofVec3f& center, float radius, float& t)
+	{
+		ofVec3f oc = origin - center;
+		float b = oc.dot(dir);
+		float c = oc.lengthSquared() - radius * radius;
+		float disc = b * b - c;
+		if (disc < 0) return false;
+
+		float s = sqrt(disc);
+		t = -b - s;
+		if (t < 0) t = -b + s;
+		return t >= 0;
+	}
+};
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// frame profiler for the editor's main thread. scopes and counters are
+// summed per frame for the overlay and kept in a ring buffer of trace
+// events that saves as chrome trace-event json (chrome://tracing, perfetto).
+//
+// everything is off by default, a disabled scope costs one branch. names
+// must be string literals, only the pointer is stored.
+
+class VoxelProfiler
+{
+public:
+
+	enum { MAX_EVENTS = 1 << 16 };
+
+	static VoxelProfiler& get()
+	{
+		static VoxelProfiler profiler;
+		return profiler;
+	}
+
+	bool isEnabled() const { return enabled; }
+
+	void setEnabled(bool v)
+	{
+		if (v == enabled) return;
+		enabled = v;
+
+		// the trace survives a toggle so it can be saved after the fact,
+		// the overlay starts over
+		if (enabled)
+		{
+			if (events.empty()) events.resize(MAX_EVENTS);
+			slots.clear();
+			last_frame = 0;
+		}
+	}
+
+	void toggle() { setEnabled(!enabled); }
+
+	// times a block from construction to the end of its scope
+	class Scope
+	{
+	public:
+
+		Scope(const char* name) : name(name), active(VoxelProfiler::get().enabled), start(0)
+		{
+			if (active) start = ofGetElapsedTimeMicros();
+		}
+
+		~Scope()
+		{
+			if (active) VoxelProfiler::get().complete(name, start, ofGetElapsedTimeMicros());
+		}
+
+	private:
+
+		const char* name;
+		bool active;
+		unsigned long long start;
+	};
+
+	// adds to a counter that resets every frame
+	void count(const char* name, long long n = 1)
+	{
+		if (!enabled) return;
+		slot(name, true).value += n;
+	}
+
+	// sets a counter that keeps its value across frames
+	void gauge(const char* name, long long v)
+	{
+		if (!enabled) return;
+		Slot& s = slot(name, true);
+		s.value = v;
+		s.sticky = true;
+	}
+
+	// closes the current frame. counters go to the trace once per frame
+	void frame()
+	{
+		if (!enabled) return;
+
+		unsigned long long now = ofGetElapsedTimeMicros();
+
+		for (int i = 0; i < slots.size(); i++)
+		{
+			Slot& s = slots[i];
+
+			if (s.counter)
+			{
+				push(s.name, 'C', now, 0, s.value);
+				s.last_value = s.value;
+				if (!s.sticky) s.value = 0;
+			}
+			else
+			{
+				s.last_us = s.us;
+				s.avg_us += (s.last_us - s.avg_us) * 0.05;
+				if (s.last_us > s.max_us) s.max_us = s.last_us;
+				s.calls_last = s.calls;
+				s.us = 0;
+				s.calls = 0;
+			}
+		}
+
+		if (last_frame) push("frame", 'X', last_frame, now - last_frame, 0);
+		last_frame = now;
+	}
+
+	void draw(int x, int y)
+	{
+		if (!enabled) return;
+
+		char buf[256];
+
+		ofSetColor(0, 160);
+		ofRect(x - 4, y - 14, 360, slots.size() * 14 + 24);
+		ofSetColor(255);
+
+		snprintf(buf, sizeof(buf), "%-16s %8s %8s %8s %5s", "", "ms", "avg", "max", "n");
+		ofDrawBitmapString(buf, x, y);
+
+		for (int i = 0; i < slots.size(); i++)
+		{
+			const Slot& s = slots[i];
+			y += 14;
+
+			if (s.counter)
+				snprintf(buf, sizeof(buf), "%-16s %8lld", s.name, s.last_value);
+			else
+				snprintf(buf, sizeof(buf), "%-16s %8.2f %8.2f %8.2f %5d", s.name,
+						 s.last_us / 1000.0, s.avg_us / 1000.0, s.max_us / 1000.0, s.calls_last);
+
+			ofDrawBitmapString(buf, x, y);
+		}
+	}
+
+	// writes the events still in the ring buffer, oldest first
+	bool saveTrace(const string& path)
+	{
+		if (num_events == 0) return false;
+
+		FILE* fp = fopen(ofToDataPath(path).c_str(), "wb");
+		if (fp == NULL)
+		{
+			ofLogError("VoxelProfiler") << "can't write " << path;
+			return false;
+		}
+
+		fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", fp);
+
+		int first = (head - num_events + MAX_EVENTS) % MAX_EVENTS;
+		for (int i = 0; i < num_events; i++)
+		{
+			const Event& e = events[(first + i) % MAX_EVENTS];
+			if (i > 0) fputs(",\n", fp);
+
+			if (e.ph == 'C')
+				fprintf(fp, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":0,\"tid\":0,\"args\":{\"value\":%lld}}",
+						e.name, e.ts, e.value);
+			else
+				fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":0,\"tid\":0}",
+						e.name, e.ts, e.dur);
+		}
+
+		fputs("]}\n", fp);
+
+		bool ok = ferror(fp) == 0;
+		fclose(fp);
+		return ok;
+	}
+
+	int getNumEvents() const { return num_events; }
+
+private:
+
+	struct Event
+	{
+		const char* name;
+		unsigned long long ts, dur;
+		long long value;
+		char ph;
+	};
+
+	struct Slot
+	{
+		const char* name;
+		bool counter, sticky;
+		double us, last_us, avg_us, max_us;
+		int calls, calls_last;
+		long long value, last_value;
+	};
+
+	bool enabled;
+	vector<Event> events;
+	int head, num_events;
+	vector<Slot> slots;
+	unsigned long long last_frame;
+
+	VoxelProfiler() : enabled(false), head(0), num_events(0), last_frame(0) {}
+
+	void complete(const char* name, unsigned long long start, unsigned long long end)
+	{
+		if (!enabled) return;
+
+		Slot& s = slot(name, false);
+		s.us += end - start;
+		s.calls++;
+
+		push(name, 'X', start, end - start, 0);
+	}
+
+	void push(const char* name, char ph, unsigned long long ts, unsigned long long dur, long long value)
+	{
+		Event& e = events[head];
+		e.name = name;
+		e.ph = ph;
+		e.ts = ts;
+		e.dur = dur;
+		e.value = value;
+
+		head = (head + 1) % MAX_EVENTS;
+		if (num_events < MAX_EVENTS) num_events++;
+	}
+
+	// a handful of names per frame, a linear scan is enough
+	Slot& slot(const char* name, bool counter)
+	{
+		for (int i = 0; i < slots.size(); i++)
+		{
+			if (slots[i].name == name || strcmp(slots[i].name, name) == 0)
+				return slots[i];
+		}
+
+		Slot s;
+		memset(&s, 0, sizeof(s));
+		s.name = name;
+		s.counter = counter;
+		slots.push_back(s);
+		return slots.back();
+	}
+};
+
+#define VOXEL_PROFILE_CAT2(a, b) a##b
+#define VOXEL_PROFILE_CAT(a, b) VOXEL_PROFILE_CAT2(a, b)
+#define VOXEL_PROFILE(name) VoxelProfiler::Scope VOXEL_PROFILE_CAT(voxel_profile_, __LINE__)(name)
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "ofMain.h"
+#include "VoxelInstances.h"
+#include "VoxelMesher.h"
+
+#include <stddef.h>
+
+// draws every voxel with one instanced call. the unit box comes from the
+// caller's vbo, per-voxel position, size and colour from a single instance
+// buffer that is re-uploaded only when the model revision changes.
+class VoxelInstanceRenderer
+{
+public:
+
+	VoxelInstanceRenderer() : instance_buffer(0), supported(false) {}
+
+	~VoxelInstanceRenderer()
+	{
+		if (instance_buffer) glDeleteBuffers(1, &instance_buffer);
+	}
+
+	bool setup()
+	{
+		supported = GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced;
+		if (!supported)
+		{
+			ofLogWarning("VoxelRenderer") << "instancing not available, falling back to per voxel drawing";
+			return false;
+		}
+
+		shader.setupShaderFromSource(GL_VERTEX_SHADER, vertexShader());
+		shader.setupShaderFromSource(GL_FRAGMENT_SHADER, fragmentShader());
+		supported = shader.linkProgram();
+
+		if (supported) glGenBuffers(1, &instance_buffer);
+
+		return supported;
+	}
+
+	bool isSupported() const { return supported; }
+
+	void update(const Voxel& voxels)
+	{
+		if (!supported) return;
+		if (!builder.update(voxels)) return;
+
+		const vector<VoxelInstance>& instances = builder.getInstances();
+
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(VoxelInstance),
+					 instances.empty() ? NULL : &instances[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void draw(ofVbo& box, int num_indices)
+	{
+		if (!supported || builder.size() == 0) return;
+
+		shader.begin();
+		box.bind();
+
+		GLint position = shader.getAttributeLocation("instance_position");
+		GLint size = shader.getAttributeLocation("instance_size");
+		GLint color = shader.getAttributeLocation("instance_color");
+
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		setAttribute(position, 3, GL_FLOAT, GL_FALSE, offsetof(VoxelInstance, x));
+		setAttribute(size, 3, GL_FLOAT, GL_FALSE, offsetof(VoxelInstance, w));
+		setAttribute(color, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(VoxelInstance, r));
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, box.getIndexId());
+		glDrawElementsInstancedARB(GL_TRIANGLES, num_indices,
+								   sizeof(ofIndexType) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+								   0, builder.size());
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+		clearAttribute(position);
+		clearAttribute(size);
+		clearAttribute(color);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		box.unbind();
+		shader.end();
+	}
+
+	size_t getNumInstances() const { return builder.size(); }
+
+private:
+
+	VoxelInstanceBuilder builder;
+	GLuint instance_buffer;
+	ofShader shader;
+	bool supported;
+
+	static void setAttribute(GLint loc, int n, GLenum type, GLboolean normalized, size_t offset)
+	{
+		if (loc < 0) return;
+		glEnableVertexAttribArray(loc);
+		glVertexAttribPointer(loc, n, type, normalized, sizeof(VoxelInstance), (const GLvoid*)offset);
+		glVertexAttribDivisorARB(loc, 1);
+	}
+
+	static void clearAttribute(GLint loc)
+	{
+		if (loc < 0) return;
+		glVertexAttribDivisorARB(loc, 0);
+		glDisableVertexAttribArray(loc);
+	}
+
+	// fixed function style lighting from the two editor lights and the
+	// global ambient, with the voxel colour standing in for the material
+	static string vertexShader()
+	{
+		return
+			"#version 120\n"
+			"attribute vec3 instance_position;\n"
+			"attribute vec3 instance_size;\n"
+			"attribute vec4 instance_color;\n"
+			"varying vec4 color;\n"
+			"varying vec3 normal;\n"
+			"varying vec3 eye_position;\n"
+			"void main() {\n"
+			"	vec4 p = vec4(gl_Vertex.xyz * instance_size + instance_position, 1.0);\n"
+			"	vec4 e = gl_ModelViewMatrix * p;\n"
+			"	eye_position = e.xyz;\n"
+			"	normal = gl_NormalMatrix * gl_Normal;\n"
+			"	color = instance_color;\n"
+			"	gl_Position = gl_ProjectionMatrix * e;\n"
+			"}\n";
+	}
+
+	static string fragmentShader()
+	{
+		return
+			"#version 120\n"
+			"varying vec4 color;\n"
+			"varying vec3 normal;\n"
+			"varying vec3 eye_position;\n"
+			"void main() {\n"
+			"	vec3 n = normalize(normal);\n"
+			"	vec3 light = gl_LightModel.ambient.rgb;\n"
+			"	for (int i = 0; i < 2; i++) {\n"
+			"		vec4 lp = gl_LightSource[i].position;\n"
+			"		vec3 l = normalize(lp.xyz - eye_position * lp.w);\n"
+			"		light += gl_LightSource[i].ambient.rgb;\n"
+			"		light += gl_LightSource[i].diffuse.rgb * max(dot(n, l), 0.0);\n"
+			"	}\n"
+			"	gl_FragColor = vec4(color.rgb * light, color.a);\n"
+			"}\n";
+	}
+
+	VoxelInstanceRenderer(const VoxelInstanceRenderer&);
+	VoxelInstanceRenderer& operator=(const VoxelInstanceRenderer&);
+};
+
+// draws the greedy meshed surface from VoxelMesher, one static vbo per
+// 16^3 chunk. edits only remesh the chunks around the regions the model
+// reports as dirty; loads, clears and a change of level rebuild everything.
+class VoxelMeshRenderer
+{
+public:
+
+	VoxelMeshRenderer() : revision(0), built(false) {}
+	~VoxelMeshRenderer() { clearMeshes(); }
+
+	// detail level, see VoxelMesher::setLevel()
+	void setLevel(int level)
+	{
+		if (level == mesher.getLevel()) return;
+		mesher.setLevel(level);
+		built = false;
+	}
+
+	int getLevel() const { return mesher.getLevel(); }
+
+	// returns true if any chunk was rebuilt
+	bool update(Voxel& voxels)
+	{
+		if (built && revision == voxels.getRevision()) return false;
+
+		unsigned long long start = ofGetElapsedTimeMicros();
+
+		vector<VoxelRegion> regions;
+		bool partial = voxels.takeDirtyRegions(regions) && built;
+
+		int chunks_built = 0;
+
+		if (partial)
+		{
+			for (int i = 0; i < regions.size(); i++)
+				mesher.updateRegion(voxels, regions[i]);
+
+			// chunks around every region, each remeshed once
+			VoxelIndex queued;
+			vector<VoxelCoord> todo;
+
+			for (int i = 0; i < regions.size(); i++)
+			{
+				VoxelRegion r = mesher.getRegion(regions[i]);
+				for (int cz = (r.z0 - 1) >> VoxelChunk::SHIFT; cz <= r.z1 >> VoxelChunk::SHIFT; cz++)
+					for (int cy = (r.y0 - 1) >> VoxelChunk::SHIFT; cy <= r.y1 >> VoxelChunk::SHIFT; cy++)
+						for (int cx = (r.x0 - 1) >> VoxelChunk::SHIFT; cx <= r.x1 >> VoxelChunk::SHIFT; cx++)
+						{
+							if (queued.find(cx, cy, cz) >= 0) continue;
+							queued.set(cx, cy, cz, todo.size());
+							todo.push_back(VoxelCoord(cx, cy, cz));
+						}
+			}
+
+			for (int i = 0; i < todo.size(); i++)
+				if (buildChunk(todo[i].x, todo[i].y, todo[i].z)) chunks_built++;
+		}
+		else
+		{
+			clearMeshes();
+			mesher.setVoxels(voxels);
+
+			const vector<VoxelChunk>& chunks = mesher.getGrid().getChunks();
+			for (int i = 0; i < chunks.size(); i++)
+				if (buildChunk(chunks[i].cx, chunks[i].cy, chunks[i].cz)) chunks_built++;
+		}
+
+		size_t num_indices = 0;
+		for (int i = 0; i < meshes.size(); i++)
+			num_indices += meshes[i]->num_indices;
+
+		stats.num_voxels = mesher.getStats().num_voxels;
+		stats.level = mesher.getLevel();
+		stats.num_triangles = num_indices / 3;
+		stats.num_quads = stats.num_triangles / 2;
+		stats.box_triangles = voxels.size() * 12;
+		stats.build_ms = (ofGetElapsedTimeMicros() - start) / 1000.0;
+		stats.num_chunks = meshes.size();
+		stats.chunks_built = chunks_built;
+
+		revision = voxels.getRevision();
+		built = true;
+
+		return true;
+	}
+
+	void draw()
+	{
+		for (int i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i]->num_indices > 0)
+				meshes[i]->vbo.drawElements(GL_TRIANGLES, meshes[i]->num_indices);
+		}
+	}
+
+	const VoxelMeshStats& getStats() const { return stats; }
+
+private:
+
+	struct ChunkMesh
+	{
+		ofVbo vbo;
+		int num_indices;
+
+		ChunkMesh() : num_indices(0) {}
+	};
+
+	VoxelMesher mesher;
+	VoxelMeshStats stats;
+
+	vector<ChunkMesh*> meshes;
+	VoxelIndex mesh_index; // chunk coordinates -> meshes
+
+	unsigned int revision;
+	bool built;
+
+	// returns false if there was nothing to do
+	bool buildChunk(int cx, int cy, int cz)
+	{
+		const VoxelChunk* chunk = mesher.getGrid().findChunk(cx, cy, cz);
+		int i = mesh_index.find(cx, cy, cz);
+
+		if (chunk == NULL && i < 0) return false;
+
+		ofMesh mesh;
+		mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+		if (chunk) mesher.buildChunk(*chunk, mesh);
+
+		if (i < 0)
+		{
+			if (mesh.getNumIndices() == 0) return false;
+
+			i = meshes.size();
+			meshes.push_back(new ChunkMesh());
+			mesh_index.set(cx, cy, cz, i);
+		}
+
+		ChunkMesh* m = meshes[i];
+		m->num_indices = mesh.getNumIndices();
+		if (m->num_indices > 0) m->vbo.setMesh(mesh, GL_STATIC_DRAW);
+		else m->vbo.clear();
+
+		return true;
+	}
+
+	void clearMeshes()
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			delete meshes[i];
+		meshes.clear();
+		mesh_index.clear();
+	}
+
+	VoxelMeshRenderer(const VoxelMeshRenderer&);
+	VoxelMeshRenderer& operator=(const VoxelMeshRenderer&);
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "VoxelData.h"
+
+#include <thread>
+#include <atomic>
+
+// runs one load, save or import at a time on a worker thread so the window
+// keeps drawing. the job works on a Voxel of its own, a copy for saves or
+// an empty one for loads, and never touches the model being edited. the
+// main thread polls and swaps the result in once the job is done.
+class VoxelTask
+{
+public:
+
+	typedef std::function<bool(Voxel& voxels, const VoxelProgress& progress)> Job;
+
+	enum State { IDLE, RUNNING, DONE, FAILED, CANCELLED };
+
+	VoxelTask() : progress(0), cancelled(false), finished(false), ok(false), start_ms(0), end_ms(0) {}
+	~VoxelTask() { cancel(); join(); }
+
+	// false if a job is still running
+	bool start(const string& name, Job job, const Voxel& initial = Voxel())
+	{
+		if (isRunning()) return false;
+
+		this->name = name;
+		result = initial;
+		progress = 0;
+		cancelled = false;
+		finished = false;
+		ok = false;
+		start_ms = ofGetElapsedTimeMillis();
+
+		thread = std::thread([this, job]()
+		{
+			bool success = job(result, [this](float f)
+			{
+				progress = f;
+				return !cancelled;
+			});
+
+			ok = success && !cancelled;
+			end_ms = ofGetElapsedTimeMillis();
+			finished = true;
+		});
+
+		return true;
+	}
+
+	void cancel() { cancelled = true; }
+
+	// blocks until the job has ended, then reports it like poll()
+	State wait()
+	{
+		if (!thread.joinable()) return IDLE;
+
+		join();
+		if (ok) return DONE;
+		return cancelled ? CANCELLED : FAILED;
+	}
+
+	// until poll() has reported how the job ended
+	bool isRunning() const { return thread.joinable(); }
+	bool isCancelled() const { return cancelled; }
+
+	float getProgress() const { return progress; }
+	const string& getName() const { return name; }
+
+	// how long the last job took, once it is done
+	unsigned long long getElapsedMillis() const { return end_ms - start_ms; }
+
+	// on the main thread: RUNNING while the job runs, then once the state
+	// it ended in, IDLE when there is nothing to report
+	State poll()
+	{
+		if (thread.joinable() && !finished) return RUNNING;
+		return wait();
+	}
+
+	// what the job built, valid after poll() returned DONE
+	Voxel& getResult() { return result; }
+
+	// drop the result's memory once it has been swapped out
+	void clearResult() { Voxel().swap(result); }
+
+private:
+
+	std::thread thread;
+	string name;
+	Voxel result;
+
+	std::atomic<float> progress;
+	std::atomic<bool> cancelled, finished;
+	bool ok;
+	unsigned long long start_ms, end_ms;
+
+	void join()
+	{
+		if (thread.joinable()) thread.join();
+	}
+
+	VoxelTask(const VoxelTask&);
+	VoxelTask& operator=(const VoxelTask&);
+};
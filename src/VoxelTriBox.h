@@ -0,0 +1,614 @@
+#pragma once
+
+#include "triboxoverlap.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+// one triangle against a batch of up to 32 boxes of the same size, the
+// cells loadObj walks for a face. the separating axis tests of triBoxOverlap() run in
+// float lanes, 16 wide with avx-512, 8 wide with avx2 and 4 wide otherwise
+// (sse2 / neon). float only decides a box when every test clears its
+// margin for rounding error; boxes that come too close to an edge case are
+// handed to triBoxOverlap() itself, so the answers are always exactly the
+// scalar ones.
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VOXEL_TRIBOX_NO_SIMD)
+#define VOXEL_TRIBOX_LANES 1
+#endif
+
+class VoxelTriBox
+{
+public:
+
+	enum Mode
+	{
+		SCALAR,
+		LANES_4,
+		LANES_8,
+		LANES_16
+	};
+
+	enum { MAX_BOXES = 32, MIN_LANE_BOXES = 4 };
+
+	// the best this cpu has unless setMode() said otherwise
+	static Mode getMode() { return mode(); }
+
+	// for benchmarks and checks, the mode is clamped to what the cpu has
+	static void setMode(Mode m)
+	{
+		Mode best = detect();
+		mode() = m > best ? best : m;
+	}
+
+	// bit i of the result is set if the triangle overlaps box i, centred at
+	// (cx[i], cy[i], cz[i]) with the given half size. n <= MAX_BOXES.
+	static uint32_t overlap(const float tri[3][3], const float* cx, const float* cy, const float* cz,
+							float half, int n)
+	{
+		Mode m = mode();
+
+		// the per triangle setup doesn't pay off for a handful of boxes
+		if (m == SCALAR || n < MIN_LANE_BOXES) return overlapScalar(tri, cx, cy, cz, half, 0, n);
+
+#ifdef VOXEL_TRIBOX_LANES
+		Setup s;
+		setup(s, tri, half);
+
+		uint32_t mask = 0;
+		int lanes = m == LANES_16 ? 16 : m == LANES_8 ? 8 : 4;
+
+		for (int i = 0; i < n; i += lanes)
+		{
+			int count = n - i < lanes ? n - i : lanes;
+			const float *x = cx + i, *y = cy + i, *z = cz + i;
+
+			// the kernel always loads full lanes, pad the tail
+			float tail[3][16];
+			if (count < lanes)
+			{
+				memset(tail, 0, sizeof(tail));
+				memcpy(tail[0], x, count * sizeof(float));
+				memcpy(tail[1], y, count * sizeof(float));
+				memcpy(tail[2], z, count * sizeof(float));
+				x = tail[0];
+				y = tail[1];
+				z = tail[2];
+			}
+
+			uint32_t unsure = 0;
+			uint32_t hit;
+
+#if defined(__x86_64__) || defined(__i386__)
+			if (m == LANES_16) hit = lanes16(s, x, y, z, unsure);
+			else if (m == LANES_8) hit = lanes8(s, x, y, z, unsure);
+			else
+#endif
+			hit = lanes4(s, x, y, z, unsure);
+
+			uint32_t valid = (1u << count) - 1;
+			mask |= (hit & valid) << i;
+			if (unsure & valid) mask |= overlapScalar(tri, cx, cy, cz, half, i, i + count, unsure);
+		}
+
+		return mask;
+#else
+		return overlapScalar(tri, cx, cy, cz, half, 0, n);
+#endif
+	}
+
+	// the reference, one triBoxOverlap() per box in [begin, end). with a
+	// lane mask only those boxes are tested.
+	static uint32_t overlapScalar(const float tri[3][3], const float* cx, const float* cy, const float* cz,
+								  float half, int begin, int end, uint32_t only = ~0u)
+	{
+		double verts[3][3];
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 3; c++)
+				verts[k][c] = tri[k][c];
+
+		double half_size[3] = { half, half, half };
+		uint32_t mask = 0;
+
+		for (int i = begin; i < end; i++)
+		{
+			if (((only >> (i - begin)) & 1) == 0) continue;
+
+			double centre[3] = { cx[i], cy[i], cz[i] };
+			if (triBoxOverlap(centre, half_size, verts)) mask |= 1u << i;
+		}
+
+		return mask;
+	}
+
+private:
+
+	// margin per unit of scale that float rounding can't cross. generous,
+	// it only decides how often the scalar test runs.
+	static float tolerance() { return 64 * FLT_EPSILON; }
+
+	struct Axis
+	{
+		float a, b;
+		float rad;
+		float tol;
+	};
+
+	// everything that depends only on the triangle
+	struct Setup
+	{
+		float t[3][3];
+		Axis axes[9];
+		float normal[3];
+		float sign[3];  // which box corner is nearest along the normal
+		float half;
+		float plane_tol;
+		float aabb_tol;
+	};
+
+	static void setup(Setup& s, const float tri[3][3], float half)
+	{
+		memcpy(s.t, tri, sizeof(s.t));
+		s.half = half;
+
+		float e[3][3];
+		float e_max = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			e[0][c] = tri[1][c] - tri[0][c];
+			e[1][c] = tri[2][c] - tri[1][c];
+			e[2][c] = tri[0][c] - tri[2][c];
+			for (int k = 0; k < 3; k++) e_max = std::max(e_max, fabsf(e[k][c]));
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			const float* ek = e[k];
+			Axis* ax = &s.axes[k * 3];
+
+			// x: e.z on v.y, -e.y on v.z
+			ax[0].a = ek[2]; ax[0].b = -ek[1];
+			// y: -e.z on v.x, e.x on v.z
+			ax[1].a = -ek[2]; ax[1].b = ek[0];
+			// z: e.y on v.x, -e.x on v.y
+			ax[2].a = ek[1]; ax[2].b = -ek[0];
+
+			for (int m = 0; m < 3; m++)
+			{
+				float f = fabsf(ax[m].a) + fabsf(ax[m].b);
+				ax[m].rad = f * half;
+				ax[m].tol = f * tolerance();
+			}
+		}
+
+		s.normal[0] = e[0][1] * e[1][2] - e[0][2] * e[1][1];
+		s.normal[1] = e[0][2] * e[1][0] - e[0][0] * e[1][2];
+		s.normal[2] = e[0][0] * e[1][1] - e[0][1] * e[1][0];
+
+		float n1 = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			s.sign[c] = s.normal[c] > 0 ? 1 : -1;
+			n1 += fabsf(s.normal[c]);
+		}
+
+		// the normal itself is off by a few ulps of e_max^2 per component
+		s.plane_tol = (n1 + 12 * e_max * e_max) * tolerance();
+		s.aabb_tol = tolerance();
+	}
+
+#ifdef VOXEL_TRIBOX_LANES
+
+	// lane wise min, max and abs of float vectors V through the int vectors
+	// I that comparisons produce. macros rather than functions, since an 8
+	// or 16 lane vector can't be passed by value outside the avx code.
+#define VOXEL_TRIBOX_MIN(a, b) ((V)(((I)(a) & (I)((a) < (b))) | ((I)(b) & ~(I)((a) < (b)))))
+#define VOXEL_TRIBOX_MAX(a, b) ((V)(((I)(a) & (I)((a) > (b))) | ((I)(b) & ~(I)((a) > (b)))))
+#define VOXEL_TRIBOX_ABS(a) ((V)((I)(a) & 0x7fffffff))
+
+	// the kernel, written once over gcc / clang vector types. V holds N
+	// floats, I the matching ints that comparisons produce.
+	template <typename V, typename I, int N>
+	static inline __attribute__((always_inline))
+	uint32_t lanes(const Setup& s, const float* cx, const float* cy, const float* cz, uint32_t& unsure)
+	{
+		V c[3];
+		memcpy(&c[0], cx, sizeof(V));
+		memcpy(&c[1], cy, sizeof(V));
+		memcpy(&c[2], cz, sizeof(V));
+
+		const V h = V() + s.half;
+
+		V v[3][3];
+		V v_max = V();
+		for (int k = 0; k < 3; k++)
+			for (int m = 0; m < 3; m++)
+			{
+				v[k][m] = (V() + s.t[k][m]) - c[m];
+				v_max = VOXEL_TRIBOX_MAX(v_max, VOXEL_TRIBOX_ABS(v[k][m]));
+			}
+
+		// rounding grows with the coordinates involved
+		const V scale = v_max + h;
+
+		I sep = I();
+		I close = sep;
+
+		// bullet 3, the nine edge cross axis tests: p = a * u + b * w for the
+		// two vertices of the AXISTEST macros against the projected box
+		// radius. per axis the two vertices and the two components it uses.
+		// inline rather than in a helper, gcc turned the helper's compares
+		// into scalar ones under the avx-512 target.
+		static const int edge_axes[9][4] = {
+			{ 0, 2, 1, 2 }, { 0, 2, 0, 2 }, { 1, 2, 0, 1 },
+			{ 0, 2, 1, 2 }, { 0, 2, 0, 2 }, { 0, 1, 0, 1 },
+			{ 0, 1, 1, 2 }, { 0, 1, 0, 2 }, { 1, 2, 0, 1 }
+		};
+		for (int k = 0; k < 9; k++)
+		{
+			const Axis& ax = s.axes[k];
+			const int* e = edge_axes[k];
+
+			V p0 = v[e[0]][e[2]] * ax.a + v[e[0]][e[3]] * ax.b;
+			V p1 = v[e[1]][e[2]] * ax.a + v[e[1]][e[3]] * ax.b;
+			V lo = VOXEL_TRIBOX_MIN(p0, p1), hi = VOXEL_TRIBOX_MAX(p0, p1);
+
+			V below = lo - ax.rad, above = -ax.rad - hi;
+			V margin = VOXEL_TRIBOX_MAX(below, above);
+			V tol = scale * ax.tol;
+			sep |= (I)(margin > tol);
+			close |= (I)(margin >= -tol);
+		}
+
+		// bullet 1, the box faces
+		for (int m = 0; m < 3; m++)
+		{
+			V lo = VOXEL_TRIBOX_MIN(v[0][m], v[1][m]);
+			lo = VOXEL_TRIBOX_MIN(lo, v[2][m]);
+			V hi = VOXEL_TRIBOX_MAX(v[0][m], v[1][m]);
+			hi = VOXEL_TRIBOX_MAX(hi, v[2][m]);
+
+			V below = lo - h, above = -h - hi;
+			V margin = VOXEL_TRIBOX_MAX(below, above);
+			V tol = scale * s.aabb_tol;
+			sep |= (I)(margin > tol);
+			close |= (I)(margin >= -tol);
+		}
+
+		// bullet 2, the triangle's plane against the nearest and farthest corner
+		V d_min = V(), d_max = V();
+		for (int m = 0; m < 3; m++)
+		{
+			V corner = h * s.sign[m];
+			d_min += (-corner - v[0][m]) * s.normal[m];
+			d_max += (corner - v[0][m]) * s.normal[m];
+		}
+		{
+			V above = -d_max;
+			V margin = VOXEL_TRIBOX_MAX(d_min, above);
+			V tol = scale * s.plane_tol;
+			sep |= (I)(margin > tol);
+			close |= (I)(margin >= -tol);
+		}
+
+		// lane i contributes bit i. through memory, element access on wide
+		// vectors turns into a lane insert or extract each.
+		static const int32_t bits[16] = {
+			1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+			1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15
+		};
+		I bit;
+		memcpy(&bit, bits, sizeof(I));
+
+		int32_t hit_bits[N], unsure_bits[N];
+		I hits = ~sep & ~close & bit;
+		I unsures = ~sep & close & bit;
+		memcpy(hit_bits, &hits, sizeof(I));
+		memcpy(unsure_bits, &unsures, sizeof(I));
+
+		uint32_t hit = 0;
+		unsure = 0;
+		for (int i = 0; i < N; i++)
+		{
+			hit |= hit_bits[i];
+			unsure |= unsure_bits[i];
+		}
+		return hit;
+	}
+
+	typedef float v4f __attribute__((vector_size(16)));
+	typedef int32_t v4i __attribute__((vector_size(16)));
+	typedef float v8f __attribute__((vector_size(32)));
+	typedef int32_t v8i __attribute__((vector_size(32)));
+	typedef float v16f __attribute__((vector_size(64)));
+	typedef int32_t v16i __attribute__((vector_size(64)));
+
+	static uint32_t lanes4(const Setup& s, const float* cx, const float* cy, const float* cz, uint32_t& unsure)
+	{
+		return lanes<v4f, v4i, 4>(s, cx, cy, cz, unsure);
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__((target("avx2")))
+	static uint32_t lanes8(const Setup& s, const float* cx, const float* cy, const float* cz, uint32_t& unsure)
+	{
+		return lanes<v8f, v8i, 8>(s, cx, cy, cz, unsure);
+	}
+
+	__attribute__((target("avx512f")))
+	static uint32_t lanes16(const Setup& s, const float* cx, const float* cy, const float* cz, uint32_t& unsure)
+	{
+		return lanes<v16f, v16i, 16>(s, cx, cy, cz, unsure);
+	}
+#endif
+
+#undef VOXEL_TRIBOX_MIN
+#undef VOXEL_TRIBOX_MAX
+#undef VOXEL_TRIBOX_ABS
+
+#endif
+
+	static Mode detect()
+	{
+#ifdef VOXEL_TRIBOX_LANES
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) return LANES_16;
+		if (__builtin_cpu_supports("avx2")) return LANES_8;
+#endif
+		return LANES_4;
+#else
+		return SCALAR;
+#endif
+	}
+
+	static Mode& mode()
+	{
+		static Mode m = detect();
+		return m;
+	}
+};
+
+// one face set up once against a grid, for finding the cells it touches.
+// cell (x, y, z) is the box from origin + (x, y, z) * step to one step
+// further. the setup moves the triangle into cell units, where every box
+// is the unit cube, and turns each of the 13 separating axes into a range:
+// the cell overlaps along axis a when a . (x, y, z) + a . (0.5, 0.5, 0.5)
+// falls inside it.
+//
+// forEachCell() rasterizes instead of testing the whole bounding box. rows
+// run along the normal's dominant axis w, so the triangle's plane cuts
+// each one down to a cell or three. the axes with no w component are the
+// 2d tests of the triangle's footprint across w; scanlines along u get the
+// span of v they allow, and each (u, v) row is checked against them once.
+// the remaining cells cost a multiply-add and two compares per axis. like
+// VoxelTriBox, cells too close to call go to triBoxOverlap(), with the
+// centre loadObj uses, so the answers match it exactly.
+class VoxelTriCells
+{
+public:
+
+	// below about this many cells in the bounding box, VoxelTriBox batches
+	// are cheaper than the setup
+	enum { MIN_CELLS = 128 };
+
+	VoxelTriCells(const float tri[3][3], const float origin[3], float step)
+		: step(step), num_footprint_axes(0), num_cell_axes(0), num_tested(0), num_fallbacks(0)
+	{
+		memcpy(this->tri, tri, sizeof(this->tri));
+		memcpy(this->origin, origin, sizeof(this->origin));
+
+		double p[3][3];
+		double p_max = 0, o_max = 0;
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 3; c++)
+			{
+				p[k][c] = ((double)tri[k][c] - origin[c]) / step;
+				p_max = std::max(p_max, fabs(p[k][c]));
+			}
+		for (int c = 0; c < 3; c++) o_max = std::max(o_max, fabs(origin[c] / (double)step));
+
+		double e[3][3];
+		double e_max = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			e[0][c] = p[1][c] - p[0][c];
+			e[1][c] = p[2][c] - p[1][c];
+			e[2][c] = p[0][c] - p[2][c];
+			for (int k = 0; k < 3; k++) e_max = std::max(e_max, fabs(e[k][c]));
+		}
+
+		double n[3] = {
+			e[0][1] * e[1][2] - e[0][2] * e[1][1],
+			e[0][2] * e[1][0] - e[0][0] * e[1][2],
+			e[0][0] * e[1][1] - e[0][1] * e[1][0]
+		};
+
+		w = 2;
+		if (fabs(n[0]) > fabs(n[w])) w = 0;
+		if (fabs(n[1]) > fabs(n[w])) w = 1;
+		u = (w + 1) % 3;
+		v = (w + 2) % 3;
+
+		// the centres loadObj hands triBoxOverlap() are rounded to float, up
+		// to a couple of ulps of the largest coordinate away from the exact
+		// ones used here. the double setup adds far less.
+		double scale = o_max + 2 * p_max + 2;
+		double slack = 16 * DBL_EPSILON * scale * scale * (1 + e_max * e_max);
+
+		// the plane goes first, it bounds each row
+		addAxis(n, p, true, scale, slack);
+
+		for (int c = 0; c < 3; c++)
+		{
+			double a[3] = { 0, 0, 0 };
+			a[c] = 1;
+			addAxis(a, p, false, scale, slack);
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			double a0[3] = { 0, e[k][2], -e[k][1] };
+			double a1[3] = { -e[k][2], 0, e[k][0] };
+			double a2[3] = { e[k][1], -e[k][0], 0 };
+			addAxis(a0, p, false, scale, slack);
+			addAxis(a1, p, false, scale, slack);
+			addAxis(a2, p, false, scale, slack);
+		}
+	}
+
+	// f(x, y, z) for each cell in [lo, hi) the face overlaps
+	template <typename F>
+	void forEachCell(const int lo[3], const int hi[3], F f)
+	{
+		int c[3];
+
+		for (c[u] = lo[u]; c[u] < hi[u]; c[u]++)
+		{
+			// the span of v the footprint allows on this scanline
+			int v_begin = lo[v], v_end = hi[v];
+			for (int i = 0; i < num_footprint_axes; i++)
+			{
+				const Axis& ax = footprint_axes[i];
+				clip(ax, ax.a[u] * c[u] + ax.mid, ax.a[v], v_begin, v_end);
+			}
+
+			for (c[v] = v_begin; c[v] < v_end; c[v]++)
+			{
+				bool row_unsure = false;
+				bool row_separated = false;
+
+				for (int i = 0; i < num_footprint_axes && !row_separated; i++)
+				{
+					const Axis& ax = footprint_axes[i];
+					int r = classify(ax, ax.a[u] * c[u] + ax.a[v] * c[v] + ax.mid);
+					if (r == SEPARATED) row_separated = true;
+					if (r == UNSURE) row_unsure = true;
+				}
+				if (row_separated) continue;
+
+				double base[NUM_AXES];
+				for (int i = 0; i < num_cell_axes; i++)
+				{
+					const Axis& ax = cell_axes[i];
+					base[i] = ax.a[u] * c[u] + ax.a[v] * c[v] + ax.mid;
+				}
+
+				int w_begin = lo[w], w_end = hi[w];
+				clip(cell_axes[0], base[0], cell_axes[0].a[w], w_begin, w_end);
+
+				for (c[w] = w_begin; c[w] < w_end; c[w]++)
+				{
+					num_tested++;
+
+					bool unsure = row_unsure;
+					bool separated = false;
+
+					for (int i = 0; i < num_cell_axes; i++)
+					{
+						int r = classify(cell_axes[i], base[i] + cell_axes[i].a[w] * c[w]);
+						if (r == SEPARATED)
+						{
+							separated = true;
+							break;
+						}
+						if (r == UNSURE) unsure = true;
+					}
+
+					if (separated) continue;
+					if (unsure && !fallback(c)) continue;
+
+					f(c[0], c[1], c[2]);
+				}
+			}
+		}
+	}
+
+	// cells that got past the footprint and the plane, and of those the
+	// ones that needed triBoxOverlap()
+	size_t getNumTested() const { return num_tested; }
+	size_t getNumFallbacks() const { return num_fallbacks; }
+
+private:
+
+	enum { NUM_AXES = 13 };
+	enum { OVERLAPS, UNSURE, SEPARATED };
+
+	struct Axis
+	{
+		double a[3];
+		double mid;     // a . (0.5, 0.5, 0.5)
+		double lo, hi;
+		double tol;
+	};
+
+	// along a, the unit cube at the origin spans +-rad around mid, and the
+	// triangle spans [t_min, t_max]. they meet when the cube's centre is
+	// within rad of the triangle's span; for the plane that span is one point.
+	void addAxis(const double a[3], const double p[3][3], bool plane, double scale, double slack)
+	{
+		Axis& ax = a[w] == 0 && !plane ? footprint_axes[num_footprint_axes++] : cell_axes[num_cell_axes++];
+
+		double t[3];
+		for (int k = 0; k < 3; k++) t[k] = a[0] * p[k][0] + a[1] * p[k][1] + a[2] * p[k][2];
+
+		double t_min = plane ? t[0] : std::min(t[0], std::min(t[1], t[2]));
+		double t_max = plane ? t[0] : std::max(t[0], std::max(t[1], t[2]));
+
+		double norm = fabs(a[0]) + fabs(a[1]) + fabs(a[2]);
+		double rad = 0.5 * norm;
+
+		memcpy(ax.a, a, sizeof(ax.a));
+		ax.mid = 0.5 * (a[0] + a[1] + a[2]);
+		ax.lo = t_min - rad;
+		ax.hi = t_max + rad;
+		ax.tol = 8 * FLT_EPSILON * norm * scale + slack;
+	}
+
+	static int classify(const Axis& ax, double d)
+	{
+		double margin = std::max(ax.lo - d, d - ax.hi);
+		if (margin > ax.tol) return SEPARATED;
+		if (margin >= -ax.tol) return UNSURE;
+		return OVERLAPS;
+	}
+
+	// narrows [begin, end) to the cells where base + slope * i isn't surely
+	// outside the axis range, give or take a cell for the division
+	static void clip(const Axis& ax, double base, double slope, int& begin, int& end)
+	{
+		if (slope == 0) return;
+
+		double t0 = (ax.lo - ax.tol - base) / slope;
+		double t1 = (ax.hi + ax.tol - base) / slope;
+		if (t0 > t1) std::swap(t0, t1);
+
+		begin = std::min<double>(std::max<double>(begin, floor(t0) - 1), end);
+		end = std::max<double>(std::min<double>(end, floor(t1) + 2), begin);
+	}
+
+	bool fallback(const int c[3])
+	{
+		num_fallbacks++;
+
+		float half = step / 2;
+		float cx = (origin[0] + c[0] * step) + half;
+		float cy = (origin[1] + c[1] * step) + half;
+		float cz = (origin[2] + c[2] * step) + half;
+		return VoxelTriBox::overlapScalar(tri, &cx, &cy, &cz, half, 0, 1) != 0;
+	}
+
+	float tri[3][3];
+	float origin[3];
+	float step;
+
+	int u, v, w;
+	Axis footprint_axes[NUM_AXES], cell_axes[NUM_AXES];
+	int num_footprint_axes, num_cell_axes;
+
+	size_t num_tested;
+	size_t num_fallbacks;
+};
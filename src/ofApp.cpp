@@ -80,6 +80,24 @@ public:
 			editor.setEditMode(Editor::EDITMODE_PICK_COLOR);
 		}
 		
+		if (key == 'm')
+		{
+			editor.toggleRenderMode();
+		}
+		else if (key == 'l')
+		{
+			editor.toggleLod();
+		}
+		
+		if (key == 'p')
+		{
+			editor.toggleProfiler();
+		}
+		else if (key == 't')
+		{
+			editor.saveTrace();
+		}
+		
 		if (key == ' ')
 		{
 			editor.put();
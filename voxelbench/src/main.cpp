@@ -0,0 +1,423 @@
+// benchmarks the model code on synthetic scenes and prints the results as
+// json, one line per scene, size and operation, so runs of two commits
+// can be diffed:
+//
+//     voxelbench [-s 16,32,64] [-n reps] > before.json
+//
+// scenes are a random scatter, a dense block, a hollow sphere and a bumpy
+// scanned-like mesh voxelized through loadObj(), each about size cells
+// wide. every operation runs reps times on a fresh setup and reports the
+// fastest run, the heap allocations and bytes it made and the peak rss of
+// the process so far. tribox times the triangle and box overlap tests.
+
+#include "ofMain.h"
+#include "VoxelData.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <sys/resource.h>
+
+static std::atomic<size_t> num_allocs(0), alloc_bytes(0);
+
+void* operator new(size_t n)
+{
+	num_allocs++;
+	alloc_bytes += n;
+
+	void* p = malloc(n ? n : 1);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+struct Random
+{
+	uint32_t s;
+
+	Random(uint32_t seed) : s(seed) {}
+
+	uint32_t next()
+	{
+		s ^= s << 13;
+		s ^= s >> 17;
+		s ^= s << 5;
+		return s;
+	}
+
+	int range(int n) { return next() % n; }
+	float uniform() { return next() / 4294967296.0f; }
+};
+
+struct Scene
+{
+	string name;
+	int size;
+	vector<VoxelData> voxels;
+	string obj_path;
+};
+
+static string tmp_dir;
+static int reps = 3;
+static bool first_result = true;
+
+static double now()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long peakRssKb()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+}
+
+static VoxelData makeVoxel(int x, int y, int z, const ofColor& color)
+{
+	VoxelData v;
+	v.id = 0;
+	v.x = x;
+	v.y = y;
+	v.z = z;
+	v.w = v.h = v.d = 1;
+	v.color = color;
+	return v;
+}
+
+// setup() runs untimed before each rep, body() is timed and handles count
+// items. what body() returns is printed as check, a hit or voxel count
+// that should only change when results do.
+template <typename Setup, typename Body>
+static void measure(const Scene& scene, const string& op, size_t count, Setup setup, Body body)
+{
+	double best = 1e30;
+	size_t allocs = 0, bytes = 0, check = 0;
+
+	for (int rep = 0; rep < reps; rep++)
+	{
+		setup();
+
+		size_t a = num_allocs, b = alloc_bytes;
+		double t = now();
+		check = body();
+		double ms = now() - t;
+
+		if (ms < best)
+		{
+			best = ms;
+			allocs = num_allocs - a;
+			bytes = alloc_bytes - b;
+		}
+	}
+
+	printf("%s{\"scene\": \"%s\", \"size\": %d, \"voxels\": %zu, \"op\": \"%s\", \"count\": %zu, "
+		   "\"check\": %zu, \"ms\": %.3f, \"per_sec\": %.0f, \"allocs\": %zu, \"alloc_bytes\": %zu, "
+		   "\"peak_rss_kb\": %ld}",
+		   first_result ? "" : ",\n", scene.name.c_str(), scene.size, scene.voxels.size(), op.c_str(), count,
+		   check, best, best > 0 ? count / best * 1000 : 0, allocs, bytes, peakRssKb());
+	fflush(stdout);
+	first_result = false;
+}
+
+static Scene makeRandom(int size)
+{
+	Scene scene = { "random", size };
+	Random rnd(1);
+
+	// an eighth of the cells, each at most once
+	vector<bool> used(size * size * size, false);
+	for (int i = 0; i < size * size * size / 8; i++)
+	{
+		int x = rnd.range(size), y = rnd.range(size), z = rnd.range(size);
+		if (used[(x * size + y) * size + z]) continue;
+
+		used[(x * size + y) * size + z] = true;
+		scene.voxels.push_back(makeVoxel(x, y, z, ofColor(rnd.range(256), rnd.range(256), rnd.range(256))));
+	}
+	return scene;
+}
+
+static Scene makeDense(int size)
+{
+	Scene scene = { "dense", size };
+
+	for (int x = 0; x < size; x++)
+		for (int y = 0; y < size; y++)
+			for (int z = 0; z < size; z++)
+				scene.voxels.push_back(makeVoxel(x, y, z, ofColor(x * 4, y * 4, z * 4)));
+	return scene;
+}
+
+static Scene makeShell(int size)
+{
+	Scene scene = { "shell", size };
+	float r = size * 0.5f, c = (size - 1) * 0.5f;
+
+	for (int x = 0; x < size; x++)
+		for (int y = 0; y < size; y++)
+			for (int z = 0; z < size; z++)
+			{
+				float d = ofVec3f(x - c, y - c, z - c).length();
+				if (d >= r - 1 && d < r) scene.voxels.push_back(makeVoxel(x, y, z, ofColor(200, 120, 40)));
+			}
+	return scene;
+}
+
+// a sphere with bumps and noise on it, like a scan, written as an obj with
+// about 16 faces per surface cell
+static Scene makeScan(int size)
+{
+	Scene scene = { "scan", size };
+	scene.obj_path = ofFilePath::join(tmp_dir, "voxelbench_scan_" + ofToString(size) + ".obj");
+
+	Random rnd(2);
+	int n = size * 2;
+
+	FILE* fp = fopen(scene.obj_path.c_str(), "w");
+	if (fp == NULL) return scene;
+
+	for (int i = 0; i <= n; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			float th = PI * i / n, ph = TWO_PI * j / n;
+			float r = size * 0.5f * (1 + 0.1f * sin(5 * th) * cos(3 * ph) + 0.01f * rnd.uniform());
+			fprintf(fp, "v %f %f %f\n", r * sin(th) * cos(ph), r * cos(th), r * sin(th) * sin(ph));
+		}
+	}
+
+	// the poles are rings of n equal vertices, which is fine for a benchmark
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			int a = i * n + j + 1, b = i * n + (j + 1) % n + 1;
+			int c = a + n, d = b + n;
+			fprintf(fp, "f %d %d %d\nf %d %d %d\n", a, c, b, b, c, d);
+		}
+	}
+	fclose(fp);
+
+	VoxelImportOptions options;
+	options.resolution = size;
+
+	Voxel voxels;
+	if (voxels.loadObj(scene.obj_path, options))
+	{
+		voxels.forEach([&](const VoxelData& v) { scene.voxels.push_back(v); });
+	}
+	return scene;
+}
+
+static void benchScene(const Scene& scene)
+{
+	const vector<VoxelData>& src = scene.voxels;
+	Voxel voxels;
+
+	measure(scene, "add", src.size(), [&]() { voxels.clear(); }, [&]()
+	{
+		for (size_t i = 0; i < src.size(); i++) voxels.add(src[i]);
+		return voxels.size();
+	});
+
+	// as many misses as hits
+	Random rnd(3);
+	vector<ofVec3f> probes;
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		probes.push_back(ofVec3f(src[i].x, src[i].y, src[i].z));
+		probes.push_back(ofVec3f(rnd.range(scene.size * 2), rnd.range(scene.size * 2), -1 - rnd.range(scene.size)));
+	}
+
+	measure(scene, "exists", probes.size(), []() {}, [&]()
+	{
+		size_t found = 0;
+		for (size_t i = 0; i < probes.size(); i++) found += voxels.exists(probes[i]);
+		return found;
+	});
+
+	string json_path = ofFilePath::join(tmp_dir, "voxelbench.json");
+	string vxb_path = ofFilePath::join(tmp_dir, "voxelbench.vxb");
+
+	measure(scene, "save_json", src.size(), []() {}, [&]() { return (size_t)voxels.save(json_path); });
+	measure(scene, "load_json", src.size(), []() {}, [&]() { voxels.load(json_path); return voxels.size(); });
+	measure(scene, "save_json_v2", src.size(), []() {}, [&]() { return (size_t)voxels.save(json_path, 2); });
+	measure(scene, "load_json_v2", src.size(), []() {}, [&]() { voxels.load(json_path); return voxels.size(); });
+	measure(scene, "save_vxb", src.size(), []() {}, [&]() { return (size_t)voxels.saveBinary(vxb_path); });
+	measure(scene, "load_vxb", src.size(), []() {}, [&]() { voxels.loadBinary(vxb_path); return voxels.size(); });
+
+	vector<ofVec3f> order;
+	for (size_t i = 0; i < src.size(); i++) order.push_back(ofVec3f(src[i].x, src[i].y, src[i].z));
+	for (size_t i = order.size(); i > 1; i--) std::swap(order[i - 1], order[rnd.range(i)]);
+
+	measure(scene, "remove", order.size(), [&]()
+	{
+		voxels.clear();
+		for (size_t i = 0; i < src.size(); i++) voxels.add(src[i]);
+	}, [&]()
+	{
+		for (size_t i = 0; i < order.size(); i++) voxels.remove(order[i]);
+		return voxels.size();
+	});
+
+	if (!scene.obj_path.empty())
+	{
+		VoxelImportOptions options;
+		options.resolution = scene.size;
+
+		measure(scene, "load_obj", src.size(), []() {}, [&]() { voxels.loadObj(scene.obj_path, options); return voxels.size(); });
+
+		options.solid = true;
+		measure(scene, "load_obj_solid", src.size(), []() {}, [&]()
+		{
+			voxels.loadObj(scene.obj_path, options);
+			return voxels.size();
+		});
+
+		ofFile::removeFile(scene.obj_path, false);
+	}
+
+	ofFile::removeFile(json_path, false);
+	ofFile::removeFile(vxb_path, false);
+}
+
+// random triangles a few cells wide against every cell of their bounding
+// box, with triBoxOverlap() and with VoxelTriBox batches
+static void benchTriBox(int size)
+{
+	Scene scene = { "tribox", size };
+	Random rnd(4);
+
+	const float half = 0.5f;
+	const int num_faces = 20000;
+
+	struct Face
+	{
+		float tri[3][3];
+		int lo[3], hi[3];
+	};
+
+	vector<Face> faces(num_faces);
+	size_t cells = 0;
+
+	for (int i = 0; i < num_faces; i++)
+	{
+		Face& f = faces[i];
+		for (int c = 0; c < 3; c++)
+		{
+			float base = rnd.uniform() * 100;
+			for (int k = 0; k < 3; k++) f.tri[k][c] = base + rnd.uniform() * size;
+
+			f.lo[c] = floor(std::min(f.tri[0][c], std::min(f.tri[1][c], f.tri[2][c])));
+			f.hi[c] = ceil(std::max(f.tri[0][c], std::max(f.tri[1][c], f.tri[2][c])));
+		}
+		cells += (size_t)(f.hi[0] - f.lo[0]) * (f.hi[1] - f.lo[1]) * (f.hi[2] - f.lo[2]);
+	}
+
+	measure(scene, "tri_box_overlap", cells, []() {}, [&]()
+	{
+		size_t hits = 0;
+		for (int i = 0; i < num_faces; i++)
+		{
+			const Face& f = faces[i];
+			double tri[3][3], halfsize[3] = { half, half, half };
+			for (int k = 0; k < 3; k++)
+				for (int c = 0; c < 3; c++) tri[k][c] = f.tri[k][c];
+
+			for (int x = f.lo[0]; x < f.hi[0]; x++)
+				for (int y = f.lo[1]; y < f.hi[1]; y++)
+					for (int z = f.lo[2]; z < f.hi[2]; z++)
+					{
+						double center[3] = { x + half, y + half, z + half };
+						hits += triBoxOverlap(center, halfsize, tri);
+					}
+		}
+		return hits;
+	});
+
+	measure(scene, "tri_box_batch", cells, []() {}, [&]()
+	{
+		size_t hits = 0;
+		float cx[VoxelTriBox::MAX_BOXES], cy[VoxelTriBox::MAX_BOXES], cz[VoxelTriBox::MAX_BOXES];
+
+		for (int i = 0; i < num_faces; i++)
+		{
+			const Face& f = faces[i];
+			int n = 0;
+
+			for (int x = f.lo[0]; x < f.hi[0]; x++)
+				for (int y = f.lo[1]; y < f.hi[1]; y++)
+					for (int z = f.lo[2]; z < f.hi[2]; z++)
+					{
+						cx[n] = x + half;
+						cy[n] = y + half;
+						cz[n] = z + half;
+						if (++n == VoxelTriBox::MAX_BOXES)
+						{
+							hits += __builtin_popcount(VoxelTriBox::overlap(f.tri, cx, cy, cz, half, n));
+							n = 0;
+						}
+					}
+			if (n) hits += __builtin_popcount(VoxelTriBox::overlap(f.tri, cx, cy, cz, half, n));
+		}
+		return hits;
+	});
+}
+
+int main(int argc, const char** argv)
+{
+	ofSetLogLevel(OF_LOG_ERROR);
+
+	vector<int> sizes;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-s" && i + 1 < argc)
+		{
+			vector<string> parts = ofSplitString(argv[++i], ",", true, true);
+			for (int k = 0; k < parts.size(); k++) sizes.push_back(std::max(2, ofToInt(parts[k])));
+		}
+		else if (arg == "-n" && i + 1 < argc) reps = std::max(1, atoi(argv[++i]));
+		else
+		{
+			fprintf(stderr, "usage: voxelbench [-s 16,32,64] [-n reps]\n");
+			return 2;
+		}
+	}
+
+	if (sizes.empty())
+	{
+		sizes.push_back(16);
+		sizes.push_back(32);
+		sizes.push_back(64);
+	}
+
+	const char* tmp = getenv("TMPDIR");
+	tmp_dir = tmp ? tmp : "/tmp";
+
+	printf("{\"benchmark\": \"voxelbench\", \"reps\": %d, \"results\": [\n", reps);
+
+	for (int i = 0; i < sizes.size(); i++)
+	{
+		benchScene(makeRandom(sizes[i]));
+		benchScene(makeDense(sizes[i]));
+		benchScene(makeShell(sizes[i]));
+		benchScene(makeScan(sizes[i]));
+		benchTriBox(std::max(1, sizes[i] / 8));
+	}
+
+	printf("\n], \"peak_rss_kb\": %ld}\n", peakRssKb());
+	return 0;
+}
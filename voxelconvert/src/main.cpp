@@ -0,0 +1,261 @@
+// headless batch converter. voxelizes obj files and converts models between
+// json and vxb without a window, a GL context or file dialogs:
+//
+//     voxelconvert [options] file...
+//
+//     -o dir       write results to dir, default next to each input
+//     -f format    vxb or json, default vxb
+//     -v version   json: 1 or 2, default 1. older readers only know 1
+//     -r cells     obj: cells along the longest side of the model
+//     -s size      obj: model units per cell, overrides -r
+//     --solid      obj: fill the inside of closed meshes
+//     -j jobs      files converted at once, default one per core
+//
+// prints one json object per file to stdout, in the order they finish:
+//
+//     {"input": "a.obj", "output": "a.vxb", "ok": true, "voxels": 51020,
+//      "load_ms": 98.1, "save_ms": 2.4, "faces": 180000, ...}
+//
+// errors go to stderr. exits with 1 if any file failed. when two inputs
+// map to the same output (a.obj and b/a.obj with -o) only the first one is
+// converted, the others fail before anything runs.
+
+#include "ofMain.h"
+#include "VoxelData.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+
+struct Job
+{
+	string input, output;
+	bool ok;
+	string error;
+	size_t voxels;
+	double load_ms, save_ms;
+	bool imported;
+	VoxelImportStats stats;
+};
+
+static double now()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static string quote(const string& s)
+{
+	string r = "\"";
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+		{
+			r += '\\';
+			r += c;
+		}
+		else if (c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			r += buf;
+		}
+		else r += c;
+	}
+	return r + "\"";
+}
+
+static void convert(Job& job, const VoxelImportOptions& options, int json_version)
+{
+	job.ok = false;
+	job.voxels = 0;
+	job.load_ms = job.save_ms = 0;
+	job.imported = false;
+
+	// set before any job started, see main()
+	if (!job.error.empty()) return;
+
+	if (job.output == job.input)
+	{
+		job.error = "output would overwrite the input";
+		return;
+	}
+
+	string ext = ofToLower(ofFilePath::getFileExt(job.input));
+
+	Voxel voxels;
+	double t = now();
+
+	bool loaded = false;
+	if (ext == "obj")
+	{
+		loaded = voxels.loadObj(job.input, options);
+		job.imported = true;
+		job.stats = voxels.getImportStats();
+	}
+	else if (ext == "json" || ext == "vxb")
+	{
+		loaded = voxels.loadFile(job.input);
+	}
+	else
+	{
+		job.error = "unknown format";
+		return;
+	}
+
+	job.load_ms = now() - t;
+
+	if (loaded == false)
+	{
+		job.error = "could not load";
+		return;
+	}
+
+	job.voxels = voxels.size();
+
+	t = now();
+	bool saved = voxels.saveFile(job.output, VoxelProgress(), json_version);
+	job.save_ms = now() - t;
+
+	if (saved == false)
+	{
+		job.error = "could not save";
+		return;
+	}
+
+	job.ok = true;
+}
+
+static void print(const Job& job)
+{
+	printf("{\"input\": %s, \"output\": %s, \"ok\": %s", quote(job.input).c_str(), quote(job.output).c_str(),
+		   job.ok ? "true" : "false");
+
+	if (job.ok == false)
+	{
+		printf(", \"error\": %s", quote(job.error).c_str());
+	}
+
+	printf(", \"voxels\": %zu, \"load_ms\": %.3f, \"save_ms\": %.3f", job.voxels, job.load_ms, job.save_ms);
+
+	if (job.imported)
+	{
+		printf(", \"faces\": %zu, \"cells_tested\": %zu, \"hits\": %zu, \"filled\": %zu, \"flooded\": %s",
+			   job.stats.faces, job.stats.cells_tested, job.stats.hits, job.stats.filled,
+			   job.stats.flooded ? "true" : "false");
+	}
+
+	printf("}\n");
+	fflush(stdout);
+}
+
+static int usage()
+{
+	fprintf(stderr, "usage: voxelconvert [-o dir] [-f vxb|json] [-v 1|2] [-r cells] [-s size] [--solid] [-j jobs] file...\n");
+	return 2;
+}
+
+int main(int argc, const char** argv)
+{
+	// stdout is for results only
+	ofSetLogLevel(OF_LOG_ERROR);
+
+	string output_dir, format = "vxb";
+	int json_version = 1;
+	VoxelImportOptions options;
+	int num_jobs = std::max(1, (int)std::thread::hardware_concurrency());
+	vector<string> inputs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (arg == "-o" && has_value) output_dir = ofFilePath::getAbsolutePath(argv[++i], false);
+		else if (arg == "-f" && has_value) format = ofToLower(argv[++i]);
+		else if (arg == "-v" && has_value) json_version = atoi(argv[++i]);
+		else if (arg == "-r" && has_value) options.resolution = atoi(argv[++i]);
+		else if (arg == "-s" && has_value) options.voxel_size = atof(argv[++i]);
+		else if (arg == "-j" && has_value) num_jobs = std::max(1, atoi(argv[++i]));
+		else if (arg == "--solid") options.solid = true;
+		else if (arg.size() > 1 && arg[0] == '-') return usage();
+		else inputs.push_back(ofFilePath::getAbsolutePath(arg, false));
+	}
+
+	if (inputs.empty() || (format != "vxb" && format != "json")) return usage();
+	if (json_version != 1 && json_version != 2) return usage();
+
+	if (!output_dir.empty() && !ofDirectory::doesDirectoryExist(output_dir, false)
+		&& !ofDirectory::createDirectory(output_dir, false, true))
+	{
+		fprintf(stderr, "could not create %s\n", output_dir.c_str());
+		return 1;
+	}
+
+	vector<Job> jobs(inputs.size());
+	for (int i = 0; i < inputs.size(); i++)
+	{
+		string dir = output_dir.empty() ? ofFilePath::getEnclosingDirectory(inputs[i], false) : output_dir;
+		jobs[i].input = inputs[i];
+		jobs[i].output = ofFilePath::join(dir, ofFilePath::getBaseName(inputs[i]) + "." + format);
+	}
+
+	// jobs run at the same time, so two of them must not write the same
+	// file or one read a file another writes. the first one keeps it.
+	std::map<string, int> writers;
+	for (int i = 0; i < jobs.size(); i++)
+	{
+		if (jobs[i].output == jobs[i].input) continue;
+
+		std::map<string, int>::iterator it = writers.find(jobs[i].output);
+		if (it != writers.end())
+			jobs[i].error = "output is also written for " + jobs[it->second].input;
+		else
+			writers[jobs[i].output] = i;
+	}
+
+	for (int i = 0; i < jobs.size(); i++)
+	{
+		std::map<string, int>::iterator it = writers.find(jobs[i].input);
+		if (it != writers.end() && it->second != i && jobs[it->second].error.empty())
+			jobs[it->second].error = "output is also an input";
+	}
+
+	// files run side by side, each voxelizes on its share of the cores
+	num_jobs = std::min(num_jobs, (int)jobs.size());
+	options.num_threads = std::max(1, (int)std::thread::hardware_concurrency() / num_jobs);
+
+	std::atomic<int> next(0);
+	std::atomic<int> failed(0);
+	std::mutex print_mutex;
+
+	auto worker = [&]()
+	{
+		int i;
+		while ((i = next++) < jobs.size())
+		{
+			convert(jobs[i], options, json_version);
+			if (jobs[i].ok == false) failed++;
+
+			std::lock_guard<std::mutex> lock(print_mutex);
+			print(jobs[i]);
+		}
+	};
+
+	vector<std::thread> threads;
+	for (int i = 1; i < num_jobs; i++)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (int i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+
+	return failed ? 1 : 0;
+}